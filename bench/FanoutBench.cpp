@@ -0,0 +1,99 @@
+/*
+ * Measures how long one message to a huge channel takes to reach its last
+ * member: the time to queue it for every member and write it to their
+ * sockets, with the fan-out split over worker threads or not.
+ *
+ * Usage: ./fanoutbench [members] [threads] [chunk] [rounds]
+ *
+ * Members are socketpairs registered as clients of an in-process server,
+ * so no network or admission limits are involved. The open file limit
+ * must allow two descriptors per member.
+ */
+#include "Server.hpp"
+#include "Handler.hpp"
+#include "Workers.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+Server *irc;
+
+using Clock = std::chrono::steady_clock;
+
+/*
+ * Read everything the members got so their socket buffers stay empty
+ * @return how many members got something
+ */
+static size_t	drain(const std::vector<int> &peers)
+{
+	char buf[4096];
+	size_t reached = 0;
+
+	for (int fd : peers)
+	{
+		bool got = false;
+		while (read(fd, buf, sizeof(buf)) > 0)
+			got = true;
+		reached += got;
+	}
+	return reached;
+}
+
+int	main(int argc, char **argv)
+{
+	size_t members = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 8000;
+	size_t threads = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 0;
+	size_t chunk = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : fanoutChunk;
+	size_t rounds = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 50;
+
+	irc = new Server("0");
+	Workers::setChunk(chunk);
+	Workers::start(threads);
+	Channel &channel = irc->addChannel("#huge");
+	std::vector<int> peers;
+	int sender = -1;
+	for (size_t idx = 0; idx <= members; ++idx)
+	{
+		int pair[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, pair) == -1)
+		{
+			std::cerr << "socketpair failed after " << idx << " members" << std::endl;
+			return 1;
+		}
+		Handler::registerClient(pair[0]);
+		User &user = irc->getClient(pair[0])->getUser();
+		user.setNick(pair[0], "m" + std::to_string(idx));
+		user.setUser("bench");
+		channel.addMember(pair[0], idx == 0);
+		if (idx == 0)
+			sender = pair[0];
+		peers.push_back(pair[1]);
+	}
+	for (int idx = 0; idx < 100; ++idx)
+		irc->poll(0);
+	drain(peers);
+	peers.erase(peers.begin());
+
+	std::vector<double> times;
+	const std::string line = ":m0!bench@localhost PRIVMSG #huge :"
+		+ std::string(60, 'x');
+	for (size_t round = 0; round < rounds; ++round)
+	{
+		auto start = Clock::now();
+		channel.message(sender, line);
+		irc->poll(0);
+		times.push_back(std::chrono::duration<double, std::micro>(Clock::now() - start).count());
+		if (size_t reached = drain(peers); reached != members)
+			std::cerr << "round " << round << ": only " << reached << " of "
+				<< members << " members got the message" << std::endl;
+	}
+	std::sort(times.begin(), times.end());
+	std::cout << members << " members, " << Workers::threads() << " worker threads, chunk "
+		<< Workers::chunk() << ": median " << size_t(times[times.size() / 2])
+		<< " us, p99 " << size_t(times[times.size() * 99 / 100])
+		<< " us to the last member" << std::endl;
+	Workers::stop();
+	return 0;
+}
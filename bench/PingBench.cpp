@@ -0,0 +1,170 @@
+/*
+ * Measures round trip latency against a running ircserv: every client
+ * keeps one PING in flight and sends the next as soon as its PONG is back.
+ * Run it once with busy_poll = 0 and once with it set to compare latency,
+ * the STATS e line printed at the end shows the cpu the server used.
+ *
+ * Usage: ./pingbench <port> [clients] [pings] [password]
+ *
+ * Connections come from rotating 127.0.0.x addresses so the per-address
+ * admission limits do not refuse them.
+ */
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+struct	Pinger
+{
+	int					sock = -1;
+	std::string			input;
+	Clock::time_point	sent;
+	size_t				left = 0;
+};
+
+static int	connectFrom(int port, size_t index)
+{
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr{};
+	int one = 1;
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(0x7f000002 + index % 250);
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+		return close(sock), -1;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+		return close(sock), -1;
+	setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	return sock;
+}
+
+static void	say(int sock, const std::string &line)
+{
+	send(sock, line.data(), line.size(), MSG_NOSIGNAL);
+}
+
+/* Read into input until it holds text, false on a closed connection */
+static bool	await(Pinger &pinger, const std::string &text)
+{
+	char buf[4096];
+
+	while (pinger.input.find(text) == std::string::npos)
+	{
+		ssize_t len = recv(pinger.sock, buf, sizeof(buf), 0);
+		if (len <= 0)
+			return false;
+		pinger.input.append(buf, len);
+	}
+	return true;
+}
+
+static double	percentile(std::vector<double> &samples, double rank)
+{
+	if (samples.empty())
+		return 0;
+	size_t idx = std::min(samples.size() - 1, size_t(samples.size() * rank));
+	std::nth_element(samples.begin(), samples.begin() + idx, samples.end());
+	return samples[idx];
+}
+
+int	main(int argc, char **argv)
+{
+	if (argc < 2 || argc > 5)
+	{
+		std::cerr << "Usage: ./pingbench <port> [clients] [pings] [password]" << std::endl;
+		return 1;
+	}
+	int port = std::atoi(argv[1]);
+	size_t count = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 50;
+	size_t pings = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 1000;
+	std::string password = argc > 4 ? argv[4] : "";
+
+	std::vector<Pinger> pingers(count);
+	for (size_t idx = 0; idx < count; ++idx)
+	{
+		Pinger &pinger = pingers[idx];
+		pinger.sock = connectFrom(port, idx);
+		if (pinger.sock == -1)
+			return std::cerr << "connect failed" << std::endl, 1;
+		say(pinger.sock, "PASS " + password + "\r\nNICK pb" + std::to_string(idx)
+			+ "\r\nUSER pb 0 * :pingbench\r\n");
+		if (not await(pinger, "001 "))
+			return std::cerr << "registration failed" << std::endl, 1;
+		pinger.input.clear();
+		pinger.left = pings;
+	}
+
+	std::vector<double> samples;
+	std::vector<pollfd> fds;
+	samples.reserve(count * pings);
+	auto start = Clock::now();
+	for (Pinger &pinger : pingers)
+	{
+		pinger.sent = Clock::now();
+		say(pinger.sock, "PING bench\r\n");
+		fds.push_back({pinger.sock, POLLIN, 0});
+	}
+	for (size_t active = count; active; )
+	{
+		if (::poll(fds.data(), fds.size(), 5000) <= 0)
+			return std::cerr << "timed out" << std::endl, 1;
+		for (size_t idx = 0; idx < count; ++idx)
+		{
+			Pinger &pinger = pingers[idx];
+			if (not (fds[idx].revents & POLLIN))
+				continue ;
+			char buf[4096];
+			ssize_t len = recv(pinger.sock, buf, sizeof(buf), 0);
+			if (len <= 0)
+				return std::cerr << "connection closed" << std::endl, 1;
+			pinger.input.append(buf, len);
+			size_t end;
+			while ((end = pinger.input.find("\r\n")) != std::string::npos)
+			{
+				bool pong = pinger.input.compare(0, 5, "PONG ") == 0
+					|| pinger.input.find(" PONG ") < end;
+				pinger.input.erase(0, end + 2);
+				if (not pong)
+					continue ;
+				samples.push_back(std::chrono::duration<double, std::micro>(
+					Clock::now() - pinger.sent).count());
+				if (--pinger.left == 0)
+				{
+					fds[idx].events = 0;
+					--active;
+					continue ;
+				}
+				pinger.sent = Clock::now();
+				say(pinger.sock, "PING bench\r\n");
+			}
+		}
+	}
+	double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+
+	std::cout << samples.size() << " round trips in " << seconds << " s, "
+		<< size_t(samples.size() / seconds) << " per second" << std::endl;
+	std::cout << "latency us p50 " << percentile(samples, 0.5)
+		<< " p99 " << percentile(samples, 0.99)
+		<< " max " << percentile(samples, 1) << std::endl;
+
+	Pinger &first = pingers.front();
+	first.input.clear();
+	say(first.sock, "STATS e\r\n");
+	if (await(first, "219 "))
+		std::cout << first.input.substr(0, first.input.find("\r\n")) << std::endl;
+	for (Pinger &pinger : pingers)
+		close(pinger.sock);
+	return 0;
+}
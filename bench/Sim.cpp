@@ -0,0 +1,307 @@
+/*
+ * Scripted workloads against the real Server, dispatcher and channels with
+ * thousands of virtual clients, no network or outside clients involved.
+ * Every scenario prints the wall and cpu time the server spent, the socket
+ * calls it made and the allocations it did, and fails when they exceed the
+ * budget recorded for it, so a performance regression fails the run.
+ *
+ * Usage: ./ircsim [-f] [clients] [senders] [messages]
+ *
+ * Clients are socketpairs registered like accepted connections; the harness
+ * writes commands into the far ends and reads what the server sends back
+ * between polls. Fan-out workers are off so every run does the same work in
+ * the same order. With -f the socket calls go through faulty replacements
+ * that read a few bytes at a time, cut writes short and refuse some with
+ * EAGAIN, so every scenario must still deliver the same lines. Budgets are
+ * only checked without -f at the default sizes, where they were measured.
+ * Exits with 1 when a scenario did not deliver what it should have or went
+ * over its budget.
+ */
+#include "Server.hpp"
+#include "Handler.hpp"
+#include "Socket.hpp"
+#include "Welcome.hpp"
+#include "Workers.hpp"
+#include <sys/ioctl.h>
+#include <sys/resource.h>
+#include <linux/sockios.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+#include <iostream>
+#include <new>
+#include <vector>
+
+Server *irc;
+
+static std::atomic<size_t>	allocations = 0;
+
+void	*operator new(size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	if (void *ptr = std::malloc(size ? size : 1))
+		return ptr;
+	throw std::bad_alloc();
+}
+
+void	operator delete(void *ptr) noexcept
+{
+	std::free(ptr);
+}
+
+void	operator delete(void *ptr, size_t) noexcept
+{
+	std::free(ptr);
+}
+
+using Clock = std::chrono::steady_clock;
+
+/* Polls in a row without a socket call before a scenario counts as done */
+constexpr static const int simQuiet = 3;
+/* Bytes a faulty recv returns at most, lines arrive in pieces */
+constexpr static const size_t simShortRead = 7;
+/* Every this many faulty writes is refused with EAGAIN, when the peer
+ * still has unread bytes so that its next read makes the socket writable */
+constexpr static const size_t simRefuseEvery = 3;
+/* Hard sendq limit while the who scenario runs, well under the reply to a
+ * WHO of the default channel */
+constexpr static const size_t simSendqHard = 16384;
+/* Clients asking for the member list in the who scenario */
+constexpr static const size_t simAskers = 10;
+/* Headroom over a budget before a scenario fails, in percent */
+constexpr static const size_t simSlack = 25;
+
+/* What the server spent on one scenario, summed over its polls only */
+struct	Cost
+{
+	double	wall = 0;
+	double	cpu = 0;
+	size_t	recvs = 0;
+	size_t	sends = 0;
+	size_t	allocs = 0;
+	size_t	lines = 0;
+};
+
+/* What a scenario may spend at the default sizes, measured on a clean run */
+struct	Budget
+{
+	size_t	recvs;
+	size_t	sends;
+	size_t	allocs;
+};
+
+struct	Virtual
+{
+	int		peer;
+	bool	open = true;
+};
+
+static std::vector<Virtual>	clients;
+
+static double	cpuNow(void)
+{
+	struct timespec now{};
+	clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+	return now.tv_sec * 1e6 + now.tv_nsec / 1e3;
+}
+
+static size_t	faultyWrites = 0;
+
+static ssize_t	shortRecv(int fd, void *buf, size_t len, int flags)
+{
+	return ::recv(fd, buf, std::min(len, simShortRead), flags);
+}
+
+/* Refuse some writes, write only half of the first buffer of every other */
+static ssize_t	faultySendmsg(int fd, const struct msghdr *msg, int flags)
+{
+	int unread = 0;
+
+	if (++faultyWrites % simRefuseEvery == 0
+		&& ioctl(fd, SIOCOUTQ, &unread) == 0 && unread > 0)
+		return errno = EAGAIN, -1;
+	if (faultyWrites % 2 == 0 || msg->msg_iovlen == 0)
+		return ::sendmsg(fd, msg, flags);
+	struct iovec first = msg->msg_iov[0];
+	struct msghdr half = *msg;
+	first.iov_len = std::max<size_t>(1, first.iov_len / 2);
+	half.msg_iov = &first;
+	half.msg_iovlen = 1;
+	return ::sendmsg(fd, &half, flags);
+}
+
+static size_t	syscalls(void)
+{
+	return Socket::calls(Socket::Recv) + Socket::calls(Socket::Send);
+}
+
+/* Read what every open client got, @return the lines read */
+static size_t	drain(void)
+{
+	char buf[65536];
+	size_t lines = 0;
+
+	for (Virtual &client : clients)
+	{
+		ssize_t len;
+		while (client.open && (len = read(client.peer, buf, sizeof(buf))) > 0)
+			lines += std::count(buf, buf + len, '\n');
+	}
+	return lines;
+}
+
+static void	say(Virtual &client, const std::string &text)
+{
+	if (write(client.peer, text.data(), text.size()) != ssize_t(text.size()))
+		std::cerr << "short write to a virtual client" << std::endl;
+}
+
+/* Poll until the server stops touching sockets */
+static Cost	settle(void)
+{
+	Cost cost;
+
+	for (int quiet = 0; quiet < simQuiet; )
+	{
+		size_t calls = syscalls();
+		size_t recvs = Socket::calls(Socket::Recv), sends = Socket::calls(Socket::Send);
+		size_t allocs = allocations.load();
+		double cpu = cpuNow();
+		auto start = Clock::now();
+		irc->poll(0);
+		cost.wall += std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+		cost.cpu += cpuNow() - cpu;
+		cost.allocs += allocations.load() - allocs;
+		cost.recvs += Socket::calls(Socket::Recv) - recvs;
+		cost.sends += Socket::calls(Socket::Send) - sends;
+		cost.lines += drain();
+		quiet = syscalls() == calls ? quiet + 1 : 0;
+	}
+	return cost;
+}
+
+/**
+ * Print a scenario and check it: lines must be expected, or at least
+ * expected when exact is false, and a budget must not be exceeded by more
+ * than the slack. @return false when a check failed
+ */
+static bool	report(const char *name, const Cost &cost, size_t expected,
+	bool exact, const Budget *budget)
+{
+	std::string failed;
+
+	if (exact ? cost.lines != expected : cost.lines < expected)
+		failed += (exact ? "  expected " : "  expected at least ")
+			+ std::to_string(expected) + " lines";
+	auto over = [&](const char *what, size_t spent, size_t limit) {
+		limit += limit * simSlack / 100;
+		if (spent > limit)
+			failed += std::string("  ") + what + " over " + std::to_string(limit);
+	};
+	if (budget)
+	{
+		over("recv", cost.recvs, budget->recvs);
+		over("send", cost.sends, budget->sends);
+		over("allocs", cost.allocs, budget->allocs);
+	}
+	std::cout << std::left << std::setw(10) << name << std::right
+		<< " wall " << std::setw(9) << size_t(cost.wall) << " us"
+		<< "  cpu " << std::setw(9) << size_t(cost.cpu) << " us"
+		<< "  recv " << std::setw(7) << cost.recvs
+		<< "  send " << std::setw(7) << cost.sends
+		<< "  allocs " << std::setw(9) << cost.allocs
+		<< "  lines " << std::setw(9) << cost.lines
+		<< (failed.empty() ? "" : "  FAIL") << failed << std::endl;
+	return failed.empty();
+}
+
+int	main(int argc, char **argv)
+{
+	bool faults = argc > 1 && std::strcmp(argv[1], "-f") == 0;
+	argv += faults;
+	argc -= faults;
+	size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000;
+	size_t senders = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 50;
+	size_t messages = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 20;
+	senders = std::min(senders, count);
+	bool budgeted = not faults && argc == 1;
+	static const Budget registerBudget{2000, 1000, 844000};
+	static const Budget joinBudget{2000, 9304, 1280514};
+	static const Budget floodBudget{100, 16012, 45239};
+	static const Budget whoBudget{20, 10, 267};
+	static const Budget splitBudget{500, 5000, 19860};
+
+	struct rlimit files{};
+	getrlimit(RLIMIT_NOFILE, &files);
+	files.rlim_cur = files.rlim_max;
+	setrlimit(RLIMIT_NOFILE, &files);
+
+	Log::setLevel(Log::Warn);
+	irc = new Server("0");
+	Welcome::build(irc->getName(), irc->getTime(), Config::current());
+	Workers::start(0);
+	if (faults)
+		Socket::install({shortRecv, Socket::system().send, faultySendmsg});
+	for (size_t idx = 0; idx < count; ++idx)
+	{
+		int pair[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, pair) == -1)
+		{
+			std::cerr << "socketpair failed after " << idx << " clients" << std::endl;
+			return 1;
+		}
+		Handler::registerClient(pair[0]);
+		clients.push_back({pair[1]});
+	}
+	bool ok = true;
+
+	// Every client gets its NICK echoed and the whole registration burst
+	std::string burst = Welcome::burst("v");
+	for (size_t idx = 0; idx < count; ++idx)
+		say(clients[idx], "NICK v" + std::to_string(idx) + "\r\nUSER sim 0 * :sim\r\n");
+	ok &= report("register", settle(), count * (1 + std::count(burst.begin(), burst.end(), '\n')),
+		true, budgeted ? &registerBudget : nullptr);
+
+	// Everyone joins at once, each JOIN goes to every member already there,
+	// and every joiner gets at least one NAMES line and its end
+	for (Virtual &client : clients)
+		say(client, "JOIN #sim\r\n");
+	ok &= report("mass-join", settle(), count * (count + 1) / 2 + 2 * count,
+		false, budgeted ? &joinBudget : nullptr);
+
+	// Every sender's lines reach every member but itself
+	for (size_t round = 0; round < messages; ++round)
+		for (size_t idx = 0; idx < senders; ++idx)
+			say(clients[idx], "PRIVMSG #sim :flood " + std::to_string(round) + "\r\n");
+	ok &= report("flood", settle(), senders * messages * (count - 1),
+		true, budgeted ? &floodBudget : nullptr);
+
+	// A member list larger than the hard sendq limit still reaches whoever
+	// asked for it, instead of evicting them
+	const Settings &settings = Config::current();
+	size_t askers = std::min(simAskers, count);
+	irc->setSendQ(simSendqHard / 2, simSendqHard, settings.sendqGrace);
+	for (size_t idx = 0; idx < askers; ++idx)
+		say(clients[idx], "WHO #sim\r\n");
+	ok &= report("who", settle(), askers * (count + 1),
+		true, budgeted ? &whoBudget : nullptr);
+	irc->setSendQ(settings.sendqSoft, settings.sendqHard, settings.sendqGrace);
+
+	// Half of the clients drop at once, the rest get one QUIT for each
+	size_t split = count / 2;
+	for (size_t idx = count - split; idx < count; ++idx)
+	{
+		close(clients[idx].peer);
+		clients[idx].open = false;
+	}
+	ok &= report("netsplit", settle(), (count - split) * split,
+		true, budgeted ? &splitBudget : nullptr);
+
+	Workers::stop();
+	return ok ? 0 : 1;
+}
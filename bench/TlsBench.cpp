@@ -0,0 +1,137 @@
+/*
+ * Measures TLS handshakes per second against a running ircserv TLS
+ * listener, first with full handshakes, then resuming the sessions the
+ * first round received.
+ *
+ * Usage: ./tlsbench <port> [connections] [password]
+ *
+ * Connections come from rotating 127.0.0.x addresses so the per-address
+ * admission limits do not refuse them.
+ */
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using Clock = std::chrono::steady_clock;
+
+struct	Round
+{
+	size_t	done = 0;
+	size_t	reused = 0;
+	size_t	failed = 0;
+	double	seconds = 0;
+};
+
+static int	connectFrom(int port, size_t index)
+{
+	int sock = socket(AF_INET, SOCK_STREAM, 0);
+	struct sockaddr_in addr{};
+
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(0x7f000002 + index % 250);
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+		return close(sock), -1;
+	addr.sin_port = htons(port);
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (connect(sock, (struct sockaddr *)&addr, sizeof(addr)) == -1)
+		return close(sock), -1;
+	return sock;
+}
+
+/*
+ * One connection: handshake, then a PING so the session tickets the server
+ * sends after the handshake arrive before the connection is closed
+ */
+static SSL_SESSION	*handshake(SSL_CTX *ctx, int port, size_t index,
+	const std::string &password, SSL_SESSION *resume, Round &round)
+{
+	int sock = connectFrom(port, index);
+	if (sock == -1)
+		return ++round.failed, nullptr;
+	SSL *ssl = SSL_new(ctx);
+	SSL_set_fd(ssl, sock);
+	if (resume)
+		SSL_set_session(ssl, resume);
+
+	auto start = Clock::now();
+	int ret = SSL_connect(ssl);
+	round.seconds += std::chrono::duration<double>(Clock::now() - start).count();
+
+	SSL_SESSION *session = nullptr;
+	if (ret == 1)
+	{
+		++round.done;
+		if (SSL_session_reused(ssl))
+			++round.reused;
+		std::string request = "PASS " + password + "\r\nPING bench\r\n";
+		SSL_write(ssl, request.data(), request.size());
+		std::string reply;
+		char buf[512];
+		while (reply.find("PONG") == std::string::npos)
+		{
+			int len = SSL_read(ssl, buf, sizeof(buf));
+			if (len <= 0)
+				break ;
+			reply.append(buf, len);
+		}
+		session = SSL_get1_session(ssl);
+		SSL_shutdown(ssl);
+	}
+	else
+	{
+		++round.failed;
+		ERR_clear_error();
+	}
+	SSL_free(ssl);
+	close(sock);
+	return session;
+}
+
+static void	report(const char *name, const Round &round)
+{
+	std::cout << name << ": " << round.done << " handshakes, "
+		<< round.reused << " resumed, " << round.failed << " failed, "
+		<< (round.seconds > 0 ? size_t(round.done / round.seconds) : 0)
+		<< " per second" << std::endl;
+}
+
+int	main(int argc, char **argv)
+{
+	if (argc < 2 || argc > 4)
+	{
+		std::cerr << "Usage: ./tlsbench <port> [connections] [password]" << std::endl;
+		return 1;
+	}
+	int port = std::atoi(argv[1]);
+	size_t count = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 400;
+	std::string password = argc > 3 ? argv[3] : "";
+
+	SSL_CTX *ctx = SSL_CTX_new(TLS_client_method());
+	SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_OFF);
+
+	Round full;
+	std::vector<SSL_SESSION *> sessions;
+	for (size_t idx = 0; idx < count; ++idx)
+		if (SSL_SESSION *session = handshake(ctx, port, idx, password, nullptr, full))
+			sessions.push_back(session);
+	report("full", full);
+
+	Round resumed;
+	for (size_t idx = 0; idx < sessions.size(); ++idx)
+	{
+		SSL_SESSION *session = handshake(ctx, port, idx, password, sessions[idx], resumed);
+		SSL_SESSION_free(session);
+		SSL_SESSION_free(sessions[idx]);
+	}
+	report("resumed", resumed);
+	SSL_CTX_free(ctx);
+	return 0;
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include <ctime>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <unordered_map>
+#include <netinet/in.h>
+
+/* Default for how many connections one readable event on the listening socket accepts */
+constexpr static const int acceptBatch = 64;
+
+/* Seconds between sweeps of idle per-address entries */
+constexpr static const std::time_t admitPruneInterval = 60;
+
+/**
+ * @struct	AdmitLimits
+ * @brief	Connection limits, rates are connections per second and bursts
+ * how many may arrive at once after a quiet period
+ */
+struct	AdmitLimits
+{
+	uint32_t	perAddress = 32;
+	double		addressRate = 8;
+	double		addressBurst = 32;
+	double		globalRate = 256;
+	double		globalBurst = 1024;
+};
+
+/**
+ * @class	Admission
+ * @brief	Decides whether a freshly accepted socket may become a Client
+ *
+ * Runs right after accept4, before anything is allocated for the
+ * connection. Every source address has a count of open connections and a
+ * token bucket for its connect rate, one more bucket limits all accepts.
+ * A refused socket is closed on the spot.
+ */
+class	Admission
+{
+	public:
+		enum	Verdict
+		{
+			Admit,
+			AddressFull,
+			AddressRate,
+			GlobalRate,
+			MemoryFull,
+		};
+
+		Verdict		admit(int fd, in_addr_t address);
+		void		track(int fd, in_addr_t address);
+		void		release(int fd);
+		void		prune(void);
+		void		setLimits(const AdmitLimits &limits);
+		const AdmitLimits	&getLimits(void) const;
+		size_t		addresses(void) const;
+		size_t		rejected(Verdict verdict) const;
+		static const char	*reason(Verdict verdict);
+
+	private:
+		struct	Bucket
+		{
+			double	tokens = -1;
+			int64_t	updated = 0;
+
+			bool	take(double rate, double burst, int64_t now);
+		};
+		struct	Entry
+		{
+			uint32_t	open = 0;
+			Bucket		bucket;
+		};
+
+		AdmitLimits								_limits;
+		std::unordered_map<in_addr_t, Entry>	_entries;
+		std::vector<in_addr_t>					_owners;
+		Bucket									_global;
+		size_t									_rejected[5] = {};
+};
@@ -2,7 +2,13 @@
 #include "User.hpp"
 #include "Server.hpp"
 #include "macro.h"
+#include "History.hpp"
+#include "Roster.hpp"
+#include "Workers.hpp"
+#include "Memory.hpp"
 #include <set>
+#include <vector>
+#include <cstdint>
 #include <ctime>
 #include <cstddef>
 #include <sys/types.h>
@@ -15,6 +21,24 @@ class Server;
 extern Server *irc;
 class User;
 
+/* Channel modes are kept as bits, bit n for letter 'a' + n */
+constexpr uint32_t modeBit(char mode) {
+	return 1u << (mode - 'a');
+}
+
+/*
+ * @struct ModeChange
+ * @brief One validated letter of a MODE change with its typed parameter
+ * @param member fd of the user +o or -o applies to
+ */
+struct ModeChange {
+	char mode;
+	bool plus;
+	string key = "";
+	size_t limit = 0;
+	int member = -1;
+};
+
 
 /*
  * @class Channel
@@ -24,39 +48,72 @@ class User;
  * @param _topic what is discussed on the channel
  * @param _users set containing sockets
  * @param _oper set for the sockets of operators
- * @param _mode set of mode
+ * @param _modes bitmask of modes, see modeBit()
+ * @param _history recent events
+ * @param _roster NAMES and WHO replies, updated on every membership change
+ * @param _local members connected to this server, rebuilt after a
+ * membership change when a message needs it
+ * @param _links links with members behind them
+ * @param _charged members charged to Memory
  */
 class Channel {
 	private:
 		time_t _startTime;
-		string _name, _passwd, _topic;
-		size_t _limit;
+		Name _name;
+		string _passwd, _topic;
+		size_t _limit = 0;
 		set<int> _users, _oper, _invite;
-		set<char> _mode{'s'};
+		uint32_t _modes = modeBit('s');
+		History _history;
+		Roster _roster;
+		mutable std::vector<int> _local;
+		mutable set<int> _links;
+		mutable bool _stale = true;
+		size_t _charged = 0;
+		void _members(void) const;
 		bool joinWithPassword(int fd, string passwd);
 		bool joinWithInvite(int fd, string passwd);
 		bool checkUser(int fd);
 	public:
 		explicit Channel(string channel);
+		~Channel();
 		bool isEmpty(void) const;
 		void setPassword(string passwd);
 		const string& getName(void) const;
-		const set<char>& getMode(void) const;
+		bool hasMode(char mode) const;
+		uint32_t getModes(void) const;
+		void setModes(uint32_t modes);
 		const set<int>& getUsers(void) const;
 		const set<int>& getOperators(void) const;
+		const set<int>& getInvited(void) const;
 		const string& getTopic(void) const;
 		const size_t& getLimit(void) const;
 		const string getTime(void) const;
-		bool setLimit(string limit);
-		void setMode(string mode);
-		void unsetMode(string umode);
+		time_t getCreated(void) const;
+		void setTime(time_t time);
+		const string& getPassword(void) const;
+		static bool parseLimit(const string &limit, size_t &out);
+		void setLimit(size_t limit);
+		void apply(const std::vector<ModeChange> &changes);
 		bool setTopic(int fd, string topic);
+		void restoreTopic(string topic);
 		const string addUser(int fd, string passwd = "");
 		void removeUser(int fd, string msg = "", string cmd = "");
-		string userList(void) const;
+		bool leave(int fd);
+		bool addMember(int fd, bool oper);
+		bool promote(int fd);
+		bool demote(int fd);
+		int findMember(const string &nick) const;
+		set<int> routes(int except = -1) const;
+		void refresh(int fd);
+		string names(const string &nick) const;
+		string who(const string &nick) const;
 		string modes(void) const;
-		bool makeOperator(int fd, string user);
 		bool kick(int op, int user);
 		void invite(int fd);
 		bool message(int fd, string name = "", string msg = "", string type = "");
+		bool deliver(const std::shared_ptr<const string> &line, int except = -1,
+			uint64_t epoch = 0) const;
+		void record(HistoryEntry::Type type, const string &source, const string &text = "");
+		const History& getHistory(void) const;
 };
@@ -1,5 +1,8 @@
 #pragma once
 #include <queue>
+#include <deque>
+#include <string>
+#include <ctime>
 #include <functional>
 #include <cstdint>
 #include <stdexcept>
@@ -8,6 +11,8 @@
 #include <memory>
 #include "User.hpp"
 #include "RecvParser.hpp"
+#include "Metrics.hpp"
+#include "Tls.hpp"
 
 class User;
 
@@ -18,24 +23,70 @@ class CommandDispatcher;
  * @param _IN function pointer for reading input
  * @param _RDHUP function pointer for when sending end closes
  * @param _HUP function pointer for disconnects
+ * @param _OUT function pointer for when the socket becomes writable
  * @param _fd file descriptor of a network socket
  * @param _initialized state of epoll registration
  * @param _self instance of a User class.
+ * @param _sendq pending output, broadcasts share one buffer between clients
+ * @param _sendqOffset bytes of the front buffer already written
+ * @param _sendqBytes bytes queued, counted against the sendq limits
+ * @param _requested bytes of queued answers to the client's own commands,
+ * left out of the limits
+ * @param _softSince when the queue went over the soft limit, 0 if under
+ * @param _closing set once the client is scheduled for eviction
+ * @param _route fd of the server link a remote user is reached through,
+ * -1 for clients connected to this server
+ * @param _link set once the connection registered as a server link
+ * @param _server name of the server the user is connected to
+ * @param _address ip address of the peer
+ * @param _anonymous *@address, what the client is counted as before it has a nick
+ * @param _visited epoch of the last Server::nextEpoch round that reached
+ * this client
+ * @param _caps IRCv3 capabilities the client enabled with CAP REQ
+ * @param _tls TLS state of a client on the TLS port, null otherwise
+ * @param _sealed leading sendq buffers that are already TLS records, the
+ * rest is plain text still to be encrypted
+ * @param _recvqCharged bytes of unfinished input charged to Memory
+ * @param _messagesCharged bytes of parsed messages charged to Memory
  */
 class Client {
 	private:
 		std::function<void(int)> _IN	=	nullptr;
 		std::function<void(int)> _RDHUP	=  	nullptr;
 		std::function<void(int)> _HUP	= 	nullptr;
+		std::function<void(int)> _OUT	= 	nullptr;
 		User _self;
 		bool _authenticated = false;
 		bool _registered = false;
 		CommandDispatcher* _dispatch;
 		std::queue<std::unique_ptr<Message>> _msg_queue;
 		RecvParser	_parser;
+		std::deque<std::shared_ptr<const std::string>> _sendq;
+		size_t _sendqOffset = 0;
+		size_t _sendqBytes = 0;
+		size_t _requested = 0;
+		size_t _sendqPeak = 0;
+		std::time_t _softSince = 0;
+		bool _closing = false;
+		std::string _closeReason;
+		const int _route;
+		bool _link = false;
+		bool _linkPending = false;
+		std::string _server;
+		std::string _address;
+		Name _anonymous;
+		uint64_t _visited = 0;
+		uint8_t _caps = 0;
+		std::unique_ptr<Tls> _tls;
+		size_t _sealed = 0;
+		size_t _recvqCharged = 0;
+		size_t _messagesCharged = 0;
+		void _release(size_t bytes);
+		bool _seal(void);
+		bool _queue(std::shared_ptr<const std::string> buf, bool requested);
 
 	public:
-		explicit Client(int fd);
+		explicit Client(int fd, int route = -1);
 		~Client();
 		const int _fd;
 		bool _initialized = false;
@@ -45,9 +96,44 @@ class Client {
 		User& getUser(void);
 		CommandDispatcher* getDispatch(void);
 		RecvParser& getParser(void);
+		void account(void);
 		void authenticate(void);
 		bool isAuthenticated(void) const;
 		bool& accessRegistered(void);
+		bool queue(std::shared_ptr<const std::string> buf);
+		bool queue(std::string msg);
+		bool reply(std::string msg);
+		enum Push { Queued, Closing, Over };
+		Push push(std::shared_ptr<const std::string> buf, bool requested = false);
+		bool flush(void);
+		bool hasPending(void) const;
+		std::string pendingOutput(void) const;
+		size_t sendqBytes(void) const;
+		size_t sendqPeak(void) const;
+		bool sendqExpired(std::time_t now) const;
+		bool visit(uint64_t epoch);
+		enum Cap : uint8_t { Batch = 1, ServerTime = 2 };
+		bool hasCap(Cap cap) const;
+		void setCaps(uint8_t caps);
+		uint8_t getCaps(void) const;
+		void startTls(void);
+		bool isTls(void) const;
+		bool decrypt(const char *data, size_t len, std::string &plain);
+		void evict(const std::string &reason);
+		bool isClosing(void) const;
+		const std::string& closeReason(void) const;
+		bool isRemote(void) const;
+		int route(void) const;
+		int getFd(void) const;
+		bool isLink(void) const;
+		void makeLink(const std::string &name);
+		bool& accessLinkPending(void);
+		const std::string& getServer(void) const;
+		void setServer(const std::string &name);
+		const std::string& getAddress(void) const;
+		void setAddress(const std::string &address);
+		/* The nick, or *@address until there is one */
+		const Name& talker(void);
 };
 
 #include "CommandDispatcher.hpp"
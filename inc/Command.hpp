@@ -54,6 +54,12 @@ class	PrivmsgCommand : public ICommand
 		void	execute(const Message &msg, int fd) override;
 };
 
+class	NoticeCommand : public ICommand
+{
+	public:
+		void	execute(const Message &msg, int fd) override;
+};
+
 class	KickCommand : public ICommand
 {
 	public:
@@ -114,6 +120,36 @@ class	PassCommand : public ICommand
 		void	execute(const Message &msg, int fd) override;
 };
 
+class	MotdCommand : public ICommand
+{
+	public:
+		void	execute(const Message &msg, int fd) override;
+};
+
+class	StatsCommand : public ICommand
+{
+	public:
+		void	execute(const Message &msg, int fd) override;
+};
+
+class	NamesCommand : public ICommand
+{
+	public:
+		void	execute(const Message &msg, int fd) override;
+};
+
+class	ChathistoryCommand : public ICommand
+{
+	public:
+		void	execute(const Message &msg, int fd) override;
+};
+
+class	ConnectCommand : public ICommand
+{
+	public:
+		void	execute(const Message &msg, int fd) override;
+};
+
 class	UnknownCommand : public ICommand
 {
 	public:
@@ -12,18 +12,18 @@ class ICommand;
  * @class	CommandDispatcher
  * @brief	A class for executing commands received from parser
  *
- * CommandDispatcher contains an unordered_map (dictionary) of command handlers
- * which it can call for any parsed Message struct passed to dispatch().
+ * CommandDispatcher looks up command handlers in an unordered_map
+ * (dictionary) shared by all clients and calls them for any parsed Message
+ * struct passed to dispatch(). Links use a second map for the server to
+ * server protocol.
  */
 class	CommandDispatcher
 {
 	public:
-		CommandDispatcher(void);
+		using Handlers = std::unordered_map<std::string, std::unique_ptr<ICommand>>;
 
 		bool	dispatch(const std::unique_ptr<Message> &msg, int fd);
 
 	private:
-		std::unordered_map<std::string, std::unique_ptr<ICommand>> _handlers;
-
 		void	_welcome(int fd);
 };
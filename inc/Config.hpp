@@ -0,0 +1,105 @@
+#pragma once
+#include <string>
+#include <cstddef>
+#include <cstdio>
+#include <sys/socket.h>
+#include "Log.hpp"
+#include "Tls.hpp"
+#include "Roster.hpp"
+#include "Workers.hpp"
+#include "Admission.hpp"
+#include "Memory.hpp"
+#include "Welcome.hpp"
+
+/* Environment variable naming the config file, and the file read without it */
+constexpr static const char *configEnv = "IRCSERV_CONFIG";
+constexpr static const char *configPath = "ircserv.conf";
+/* The epoll batch doubles while full batches come back, up to this many */
+constexpr static const int epollEventsMax = 65536;
+
+/**
+ * @struct	Settings
+ * @brief	Tunables read from the config file, environment variables
+ * override the keys they used to set on their own
+ *
+ * The first group is read once at startup, the rest is applied again on
+ * SIGHUP.
+ */
+struct	Settings
+{
+	std::string	tlsPort;
+	std::string	tlsCert = tlsCertPath;
+	std::string	tlsKey = tlsKeyPath;
+	std::string	logFile;
+	size_t		shards = 1;
+	bool		pin = false;
+
+	Log::Level	logLevel = Log::Info;
+	size_t		backlog = SOMAXCONN;
+	/* Starting size of the epoll batch, it grows while batches come back full */
+	size_t		epollEvents = 100;
+	/* Microseconds to spin before epoll sleeps, 0 always sleeps */
+	long		busyPoll = 0;
+	/* Also set SO_BUSY_POLL to busyPoll on client sockets */
+	bool		busyPollSocket = false;
+	/* Average milliseconds per loop iteration and ready clients per batch
+	 * past which WHO, NAMES, STATS and multi-channel JOIN get 263, 0 is no limit */
+	size_t		overloadLag = 200;
+	size_t		overloadQueue = 5000;
+	size_t		accepts = acceptBatch;
+	size_t		recvBuffer = BUFSIZ;
+	size_t		lineMax = 512;
+	/* Unparsed and undispatched input a client may hold */
+	size_t		recvq = 16 * 1024;
+	/* Queued output; answers to the client's own JOIN, NAMES and WHO are
+	 * left out so that the member list of a large channel fits */
+	size_t		sendqSoft = 256 * 1024;
+	size_t		sendqHard = 1024 * 1024;
+	size_t		sendqGrace = 10;
+	AdmitLimits	admit;
+	/* -1 is one less than the cpu count, none when running shards */
+	long		fanoutThreads = -1;
+	size_t		chunk = fanoutChunk;
+	size_t		nickMax = 9;
+	size_t		channelMax = 50;
+	/* 0 turns memory shedding off */
+	size_t		memory = memoryBudget;
+	std::string	motdFile = motdPath;
+};
+
+/**
+ * @class	Config
+ * @brief	Reads `key = value` lines into Settings
+ *
+ * Sizes take a k, m or g suffix, `#` starts a comment. A file with any bad
+ * line is rejected as a whole, so a reload either applies every value or
+ * none and the running settings stay as they were.
+ */
+class	Config
+{
+	private:
+		Config(void) = delete;
+
+		static Settings		_current;
+		static std::string	_path;
+		static size_t		_reloads;
+
+		static bool	_read(const std::string &path, Settings &out);
+		static bool	_environment(Settings &out);
+
+	public:
+		/**
+		 * Read the file named by IRCSERV_CONFIG, else ircserv.conf when it
+		 * exists, then the environment variables
+		 * @return false if a value is invalid or the named file is missing
+		 */
+		static bool	load(void);
+		/**
+		 * Read the same file again, keys that need a restart keep their value
+		 * @return false if nothing changed because the file was rejected
+		 */
+		static bool	reload(void);
+		static const Settings	&current(void);
+		static const std::string	&path(void);
+		static size_t	reloads(void);
+};
@@ -0,0 +1,45 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+
+class Channel;
+class Client;
+
+/* TARGMAX limits advertised in 005 */
+constexpr static const size_t targmaxMessage = 4;
+constexpr static const size_t targmaxChannel = 10;
+
+/**
+ * @class	Fanout
+ * @brief	Delivery of one PRIVMSG or NOTICE to a list of targets
+ *
+ * The line is formatted once per target and queued to the union of the
+ * recipients: a user on several of the targeted channels, or named directly
+ * as well, gets the first copy only. Remote recipients are not delivered to
+ * here, every link collects the targets it has recipients for and gets one
+ * line naming all of them when flush() is called.
+ */
+class	Fanout
+{
+	private:
+		Client								&_from;
+		std::string							_head;
+		std::string							_tail;
+		int									_except;
+		uint64_t							_epoch;
+		std::map<int, std::vector<std::string>>	_routes;
+
+		void	_route(int link, const std::string &target);
+
+	public:
+		Fanout(Client &from, const std::string &command,
+			const std::string &text, int except = -1);
+
+		void	channel(const Channel &ch);
+		void	user(Client &to, const std::string &nick);
+		void	flush(void);
+};
+
+std::vector<std::string>	splitList(const std::string &list, bool unique = true);
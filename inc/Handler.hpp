@@ -10,16 +10,21 @@
 #include <sys/socket.h>
 #include <sys/types.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 
 class Server;
 extern Server *irc;
 
+/* Reads of one client per event before the others get their turn */
+constexpr static const size_t readBatch = 16;
+
 class Handler {
 	private:
 		Handler() = delete;
 	public:
 		static void clientWrite(int fd);
-		static void clientDisconnect(int fd);
+		static void clientFlush(int fd);
 		static void acceptClient(int fd);
+		static void registerClient(int fd);
 
 };
@@ -0,0 +1,71 @@
+#pragma once
+#include <deque>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include "Name.hpp"
+#include <unordered_set>
+
+/* Per channel bounds, whichever is reached first evicts the oldest entry */
+constexpr static const size_t historyLines = 128;
+constexpr static const size_t historyBytes = 32 * 1024;
+/* Bound for all channels together, and the most a CHATHISTORY reply sends */
+constexpr static const size_t historyBudget = 16 * 1024 * 1024;
+constexpr static const size_t historyReplyMax = 100;
+
+/**
+ * @struct	HistoryEntry
+ * @brief	One event kept for CHATHISTORY
+ * @param time	milliseconds since the epoch
+ * @param source	nick!user@host of the sender
+ * @param text	message, topic or part reason
+ */
+struct	HistoryEntry
+{
+	enum Type : uint8_t { Privmsg, Join, Part, Topic };
+
+	int64_t				time;
+	Name				source;
+	Type				type;
+	std::string			text;
+};
+
+/**
+ * @class	History
+ * @brief	Ring of the latest events on a channel
+ *
+ * Entries are bounded by count and bytes per channel. Sources are interned
+ * Names so a nick talking a lot is stored once. All histories share a global
+ * budget; going over it trims every channel down to three quarters of what
+ * it holds, so the cost is paid once per quarter of the budget.
+ */
+class	History
+{
+	private:
+		std::deque<HistoryEntry>	_entries;
+		size_t						_bytes = 0;
+
+		static std::unordered_set<History *>			_all;
+		static size_t	_total;
+		static size_t	_evicted;
+
+		static size_t	_cost(const HistoryEntry &entry);
+		void	_popFront(void);
+		void	_trim(size_t bytes);
+
+	public:
+		History(void);
+		History(const History &) = delete;
+		History &operator=(const History &) = delete;
+		~History();
+
+		void	add(HistoryEntry::Type type, const std::string &source,
+			const std::string &text);
+		const std::deque<HistoryEntry>&	entries(void) const;
+		static std::string	format(const HistoryEntry &entry, const std::string &channel);
+
+		static int64_t	now(void);
+		static bool	shrink(void);
+		static size_t	total(void);
+		static size_t	evicted(void);
+};
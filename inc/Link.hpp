@@ -0,0 +1,124 @@
+#pragma once
+#include <string>
+#include <vector>
+#include "Command.hpp"
+#include "Message.hpp"
+
+class Channel;
+class Client;
+
+/**
+ * @class	Link
+ * @brief	Helpers for the server to server protocol
+ *
+ * Servers form a tree, every message is passed on to all links except the
+ * one it came from. Users on other servers are Clients with an id above
+ * remoteIdBase whose output is routed through the link they came from.
+ * Channel messages cross each link once, the server on the other side
+ * delivers them to its own members.
+ */
+class	Link
+{
+	private:
+		Link(void) = delete;
+
+	public:
+		static void			connect(const std::string &host, const std::string &port);
+		static void			attach(int fd, const std::string &address);
+		static void			handshake(int fd);
+		static void			burst(int fd);
+		static void			unlink(int fd, const std::string &reason);
+		static void			relay(const Message &msg, int fd);
+		static void			kill(Client &client, const std::string &reason);
+		static void			applyModes(Channel &ch, const Message &msg, size_t index);
+		static Client		*origin(const Message &msg, int link);
+		static std::string	prefix(const Message &msg, int link);
+		static std::string	format(const Message &msg);
+		static std::string	introduce(Client &client);
+		static std::string	join(Channel &ch, int fd);
+		static std::vector<std::string>	sjoin(const Channel &ch, int except);
+};
+
+class	ServerCommand : public ICommand
+{
+	public:
+		void	execute(const Message &msg, int fd) override;
+};
+
+class	LinkServerCommand : public ICommand
+{
+	public:
+		void	execute(const Message &msg, int fd) override;
+};
+
+class	LinkSquitCommand : public ICommand
+{
+	public:
+		void	execute(const Message &msg, int fd) override;
+};
+
+class	LinkNickCommand : public ICommand
+{
+	public:
+		void	execute(const Message &msg, int fd) override;
+};
+
+class	LinkSjoinCommand : public ICommand
+{
+	public:
+		void	execute(const Message &msg, int fd) override;
+};
+
+class	LinkPartCommand : public ICommand
+{
+	public:
+		void	execute(const Message &msg, int fd) override;
+};
+
+class	LinkPrivmsgCommand : public ICommand
+{
+	public:
+		void	execute(const Message &msg, int fd) override;
+};
+
+class	LinkQuitCommand : public ICommand
+{
+	public:
+		void	execute(const Message &msg, int fd) override;
+};
+
+class	LinkKillCommand : public ICommand
+{
+	public:
+		void	execute(const Message &msg, int fd) override;
+};
+
+class	LinkModeCommand : public ICommand
+{
+	public:
+		void	execute(const Message &msg, int fd) override;
+};
+
+class	LinkTopicCommand : public ICommand
+{
+	public:
+		void	execute(const Message &msg, int fd) override;
+};
+
+class	LinkKickCommand : public ICommand
+{
+	public:
+		void	execute(const Message &msg, int fd) override;
+};
+
+class	LinkInviteCommand : public ICommand
+{
+	public:
+		void	execute(const Message &msg, int fd) override;
+};
+
+class	LinkErrorCommand : public ICommand
+{
+	public:
+		void	execute(const Message &msg, int fd) override;
+};
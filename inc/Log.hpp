@@ -0,0 +1,124 @@
+#pragma once
+#include <atomic>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+/* Environment variables that pick the level and a file instead of stderr */
+constexpr static const char *logLevelEnv = "IRCSERV_LOG_LEVEL";
+constexpr static const char *logFileEnv = "IRCSERV_LOG_FILE";
+/* Ring size in lines, and the longest line kept, longer ones are cut */
+constexpr static const size_t logSlots = 4096;
+constexpr static const size_t logLineMax = 240;
+/* Lines a single call site may log per second before it is suppressed */
+constexpr static const uint32_t logRateBurst = 20;
+
+/**
+ * @struct	LogSlot
+ * @brief	One line in the ring, seq tells producers and the writer thread
+ * whose turn it is to use it
+ */
+struct	LogSlot
+{
+	std::atomic<size_t>	seq;
+	size_t				ticket;
+	int64_t				time;
+	uint8_t				level;
+	uint16_t			len;
+	char				line[logLineMax];
+};
+
+/**
+ * @class	Log
+ * @brief	Leveled logger that never writes from the caller's thread
+ *
+ * Callers format straight into a slot of a bounded lock-free ring and
+ * return. A writer thread drains the ring in batches, one write() for
+ * everything that is queued. When the ring is full lines are dropped and
+ * counted instead of blocking the event loop. Each call site is rate
+ * limited on its first argument, which must be a string literal; the number
+ * of suppressed lines is added to the next one that gets through.
+ *
+ * Before start() and after stop() lines are written synchronously.
+ */
+class	Log
+{
+	public:
+		enum	Level : uint8_t { Debug, Info, Warn, Error };
+
+		static void	start(Level level, const std::string &path = "");
+		static void	stop(void);
+		static Level	level(void);
+		static void	setLevel(Level level);
+		static bool	parseLevel(const std::string &name, Level &level);
+		static const char	*levelName(Level level);
+		static size_t	dropped(void);
+		static size_t	suppressed(void);
+
+		template <typename... Args>
+		static void	debug(const char *what, const Args &... args) { _log(Debug, what, args...); }
+		template <typename... Args>
+		static void	info(const char *what, const Args &... args) { _log(Info, what, args...); }
+		template <typename... Args>
+		static void	warn(const char *what, const Args &... args) { _log(Warn, what, args...); }
+		template <typename... Args>
+		static void	error(const char *what, const Args &... args) { _log(Error, what, args...); }
+
+	private:
+		Log(void) = delete;
+
+		static std::atomic<uint8_t>	_level;
+
+		static LogSlot	*_reserve(void);
+		static void		_commit(LogSlot *slot, Level level);
+		static uint32_t	_allow(const char *what, bool &allowed);
+
+		static void	_put(LogSlot *slot, std::string_view text)
+		{
+			size_t len = std::min(text.size(), logLineMax - slot->len);
+			std::memcpy(slot->line + slot->len, text.data(), len);
+			slot->len += len;
+		}
+
+		template <typename T>
+		static void	_put(LogSlot *slot, const T &value)
+		{
+			if constexpr (std::is_same_v<T, char>)
+				_put(slot, std::string_view(&value, 1));
+			else if constexpr (std::is_integral_v<T>)
+			{
+				char buf[24];
+				auto res = std::to_chars(buf, buf + sizeof(buf), value);
+				_put(slot, std::string_view(buf, res.ptr - buf));
+			}
+			else
+				_put(slot, std::string_view(value));
+		}
+
+		template <typename... Args>
+		static void	_log(Level level, const char *what, const Args &... args)
+		{
+			if (level < _level.load(std::memory_order_relaxed))
+				return ;
+			bool allowed;
+			uint32_t skipped = _allow(what, allowed);
+			if (not allowed)
+				return ;
+			LogSlot *slot = _reserve();
+			if (not slot)
+				return ;
+			_put(slot, what);
+			(_put(slot, args), ...);
+			if (skipped)
+			{
+				_put(slot, " (");
+				_put(slot, skipped);
+				_put(slot, " similar lines suppressed)");
+			}
+			_commit(slot, level);
+		}
+};
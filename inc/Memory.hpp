@@ -0,0 +1,47 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+/* Default for memory_budget, 0 turns shedding off */
+constexpr static const size_t memoryBudget = size_t(1) << 30;
+/* Percent of the budget where each shedding step starts */
+constexpr static const size_t memoryTrimAt = 80;
+constexpr static const size_t memoryRefuseAt = 90;
+constexpr static const size_t memoryEvictAt = 100;
+/* Estimated bytes of one channel membership: set node, roster entry and
+ * its share of the NAMES and WHO lines */
+constexpr static const size_t memberBytes = 160;
+
+/**
+ * @class	Memory
+ * @brief	Bytes held by the large structures of the server, counted
+ * against one budget
+ *
+ * Owners charge what they allocate and release it again, so the totals are
+ * always current without walking anything. Sendq bytes count a broadcast
+ * line once for every recipient, an upper bound of what is really held.
+ * pressure() tells the event loop how far to shed: trim caches, then
+ * refuse new connections, then evict the biggest sendqs.
+ */
+class	Memory
+{
+	public:
+		enum	Kind : uint8_t { Clients, Recvq, Sendq, Messages, Members, History, Names, Kinds };
+		enum	Pressure : uint8_t { Normal, Trim, Refuse, Evict };
+
+		static void	charge(Kind kind, size_t bytes);
+		static void	release(Kind kind, size_t bytes);
+		static size_t	used(Kind kind);
+		static size_t	total(void);
+		static const char	*name(Kind kind);
+		static void	setBudget(size_t bytes);
+		static size_t	budget(void);
+		static Pressure	pressure(void);
+
+	private:
+		Memory(void) = delete;
+
+		static std::atomic<size_t>	_used[Kinds];
+		static size_t	_budget;
+};
@@ -0,0 +1,24 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+
+/**
+ * @struct	Metrics
+ * @brief	Counters the server exports through the STATS command, atomic
+ * since fan-out workers update them too
+ */
+struct	Metrics
+{
+	std::atomic<size_t>	sendqPeak = 0;
+	std::atomic<size_t>	sendqEvictions = 0;
+	std::atomic<size_t>	hangups = 0;
+	std::atomic<size_t>	closed = 0;
+	std::atomic<size_t>	memoryTrims = 0;
+	std::atomic<size_t>	memoryEvictions = 0;
+	std::atomic<size_t>	overlongLines = 0;
+	std::atomic<size_t>	recvqEvictions = 0;
+	std::atomic<size_t>	epollGrows = 0;
+	std::atomic<size_t>	spinHits = 0;
+	std::atomic<size_t>	spinMisses = 0;
+	std::atomic<size_t>	shedCommands = 0;
+};
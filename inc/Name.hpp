@@ -0,0 +1,61 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <cstddef>
+#include <unordered_map>
+
+/**
+ * @class	Name
+ * @brief	Handle to an interned nick, user, host or channel name
+ *
+ * Equal strings share one reference counted entry, so copying a name is a
+ * pointer copy and comparing two names compares pointers. The hash and the
+ * entry of the lower-case form are worked out once when a string is first
+ * interned; same() compares those, which is how IRC compares nicks. Names
+ * are only created and dropped on the event loop thread.
+ */
+class	Name
+{
+	public:
+		Name(void) = default;
+		Name(std::string_view text);
+		Name(const Name &other);
+		Name(Name &&other) noexcept;
+		Name	&operator=(const Name &other);
+		Name	&operator=(Name &&other) noexcept;
+		~Name();
+
+		const std::string	&str(void) const;
+		bool	empty(void) const;
+		size_t	hash(void) const;
+		/* The name that other spellings differing only in case share */
+		Name	fold(void) const;
+		bool	same(const Name &other) const;
+		bool	operator==(const Name &other) const { return _entry == other._entry; }
+
+		struct	Hash
+		{
+			size_t	operator()(const Name &name) const { return name.hash(); }
+		};
+
+		/* The interned name equal to text, empty if there is none */
+		static Name	lookup(std::string_view text);
+		static std::string	lowercase(std::string_view text);
+		static size_t	count(void);
+
+	private:
+		struct	Entry
+		{
+			std::string	text;
+			size_t		hash;
+			size_t		refs;
+			Entry		*folded;
+		};
+
+		Entry	*_entry = nullptr;
+
+		static std::unordered_map<std::string_view, Entry *>	_table;
+
+		static Entry	*_acquire(std::string_view text);
+		static void	_release(Entry *entry);
+};
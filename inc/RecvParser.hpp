@@ -18,14 +18,26 @@ class	RecvParser
 
 		std::queue<std::unique_ptr<Message>> &getQueue(void);
 		void	feed(const char *read_buf, size_t len);
+		const std::string	&pending(void) const;
+		void	restore(const std::string &data);
+		static void	setLineMax(size_t bytes);
+		void	pop(void);
+		size_t	queued(void) const;
+		size_t	overlong(void) const;
+		size_t	discarded(void) const;
+		static size_t	footprint(const Message &msg);
 
 	private:
 		std::string	_buffer;
 		std::queue<std::unique_ptr<Message>> &_output;
+		static size_t	_lineMax;
+		size_t	_queued = 0;
+		bool	_discarding = false;
+		size_t	_overlong = 0;
+		size_t	_discarded = 0;
 
 		RecvParser(void) = delete;
 
-		void	_normalizeNewLines(void);
-		void	_parseBuffer(void);
+		void	_parseLine(const std::string &line);
 		Message	_parseMessage(const std::string &msg);
 };
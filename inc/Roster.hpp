@@ -0,0 +1,59 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+class User;
+
+/* Longest nick a NAMES reply leaves room for, remote servers may allow more than 9 */
+constexpr static const size_t rosterNickMax = 30;
+
+/**
+ * @class	Roster
+ * @brief	Rendered NAMES and WHO replies of a channel, kept up to date as
+ * members come and go
+ *
+ * Members are packed into chunks whose names fit one 353 line within the
+ * 512 byte limit. A join appends to the last chunk, a part, nick or op
+ * change only marks the member's chunk for rebuilding, so a mass join costs
+ * O(n) in total instead of rebuilding the whole list every time. Chunks are
+ * repacked when parts leave too many of them half empty.
+ */
+class	Roster
+{
+	private:
+		struct	Entry
+		{
+			size_t		chunk;
+			std::string	name;
+			std::string	who;
+		};
+		struct	Chunk
+		{
+			std::vector<int>	members;
+			size_t				bytes = 0;
+			std::string			names;
+			bool				dirty = false;
+		};
+
+		std::string							_channel;
+		size_t								_budget;
+		size_t								_bytes = 0;
+		std::unordered_map<int, Entry>		_entries;
+		mutable std::vector<Chunk>			_chunks;
+
+		void	_render(Entry &entry, const User &user, bool oper) const;
+		void	_place(int fd, Entry &entry);
+		void	_unplace(int fd, size_t index, size_t size);
+		void	_repack(void);
+		void	_rebuild(void) const;
+
+	public:
+		explicit Roster(const std::string &channel);
+
+		void	add(int fd, const User &user, bool oper);
+		void	remove(int fd);
+		void	update(int fd, const User &user, bool oper);
+		std::string	names(const std::string &nick) const;
+		std::string	who(const std::string &nick) const;
+};
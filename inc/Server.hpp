@@ -1,5 +1,6 @@
 #pragma once
 #include <map>
+#include <set>
 #include <array>
 #include <ctime>
 #include <vector>
@@ -13,6 +14,10 @@
 #include "Client.hpp"
 #include "Handler.hpp"
 #include "Channel.hpp"
+#include "Metrics.hpp"
+#include "TopK.hpp"
+#include "Admission.hpp"
+#include "Config.hpp"
 #include <sys/epoll.h>
 #include <sys/types.h>
 #include <arpa/inet.h>
@@ -20,25 +25,74 @@
 #include <netinet/in.h>
 #include <unordered_map>
 
-constexpr static const std::array<uint32_t, 3> eventTypes{EPOLLIN, EPOLLHUP, EPOLLRDHUP};
+/* Remote users get ids from here up, far above any file descriptor */
+constexpr static const int remoteIdBase = 1 << 24;
+/* Seconds between checks for clients stuck over the soft sendq limit */
+constexpr static const std::time_t sendqCheckInterval = 1;
+
+constexpr static const std::array<uint32_t, 4> eventTypes{EPOLLIN, EPOLLOUT, EPOLLHUP, EPOLLRDHUP};
 
 class Client;
 
+/*
+ * @struct Timer
+ * @brief A task the event loop runs every interval seconds
+ */
+struct Timer {
+	std::time_t interval;
+	std::time_t next;
+	std::function<void()> task;
+};
+
 class Server {
 	private:
+		Metrics _metrics;
+		Hitters _hitters;
+		Admission _admission;
 		std::map<std::string, class Channel> _channels;
 		std::unordered_map<int, std::shared_ptr<Client>> _clients;
 		std::vector<epoll_event> _events;
 		std::time_t _startTime;
 		const int _fd;
 		const int _sock;
+		int _tlsSock = -1;
 		std::string::size_type _checker;
 		const int _port;
-		const int _max_events = 100;
+		int _max_events;
+		long _busyPoll = 0;
+		long _lag = 0;
+		long _lagLimit = 0;
+		size_t _depth = 0;
+		size_t _depthLimit = 0;
 		std::string _password;
+		std::string _name;
+		std::map<std::string, int> _servers;
+		std::unordered_map<Name, int, Name::Hash> _nicks;
+		std::set<int> _links;
+		int _nextRemote = remoteIdBase;
+		uint64_t _epoch = 0;
+		std::set<int> _pending;
+		std::set<int> _readable;
+		std::vector<int> _evicted;
+		std::vector<std::shared_ptr<Client>> _removed;
+		std::vector<Timer> _timers;
+		size_t _sendqSoft = 256 * 1024;
+		size_t _sendqHard = 1024 * 1024;
+		std::time_t _sendqGrace = 10;
+		void _listen(const std::string &port);
 		void _reloadHandler(Client &client) const;
+		int _wait(int tout);
+		void _flushPending(void);
+		void _reapEvicted(void);
+		void _shed(void);
+		void _closeRemoved(void);
+		int _timeout(void) const;
+		void _runTimers(void);
 	public:
-		Server(std::string port = "6667", std::string passwd = "");
+		/*
+		* @param sock listening socket to take over, -1 opens a new one
+		*/
+		Server(std::string port = "6667", std::string passwd = "", int sock = -1);
 		virtual ~Server();
 		void addClient(int fd);
 		/*
@@ -64,9 +118,115 @@ class Server {
 		* @return true if match or empty, false if neither
 		*/
 		bool checkPassword(std::string password = "") const;
+		const std::string& getPassword(void) const;
+		/*
+		* @brief Wait for and handle events
+		* @param tout milliseconds to wait, -1 waits until the next timer is due
+		*/
 		void poll(int tout = -1);
+		void addTimer(std::time_t interval, std::function<void()> task);
 		const std::unordered_map<int, std::shared_ptr<Client>>& getClients() const;
 		Client* getClient(int fd);
 		int getServerFd() const;
+		int getListenFd() const;
+		/*
+		* @brief Open a second listening socket whose clients speak TLS, Tls::init
+		* has to succeed first
+		*/
+		void listenTls(const std::string &port);
+		int getTlsFd() const;
+		void setStartTime(std::time_t start);
+		std::time_t getStartTime(void) const;
+		/*
+		* @brief Remember a client with queued output, flushed at the end of poll
+		*/
+		void markPending(int fd);
+		/*
+		* @brief Remember a client that still has input after its read batch,
+		* read again on the next poll without waiting for an event
+		*/
+		void markReadable(int fd);
+		/*
+		* @brief Remember a client to disconnect once the current events are done
+		*/
+		void markEvicted(int fd);
+		/*
+		* @brief Per-client sendq limits in bytes. Going over hard disconnects at
+		* once, staying over soft for longer than grace seconds does too.
+		*/
+		void setSendQ(size_t soft, size_t hard, std::time_t grace);
+		/*
+		* @brief Apply the settings that may change while running: epoll batch,
+		* listen backlog, sendq and connection limits, longest line
+		*/
+		void configure(const Settings &settings);
+		size_t getSendqSoft(void) const;
+		size_t getSendqHard(void) const;
+		std::time_t getSendqGrace(void) const;
+		/*
+		* @brief Evict the clients that stayed over the soft sendq limit for
+		* longer than grace, also when nothing new is queued to them
+		*/
+		void expireSendq(void);
+		Metrics& metrics(void);
+		Hitters& hitters(void);
+		/* Current size of the epoll event array */
+		int eventBatch(void) const;
+		/*
+		* @brief True while expensive commands should be turned away, see
+		* overload_lag and overload_queue
+		*/
+		bool overloaded(void) const;
+		/* Average microseconds one loop iteration spends on its events */
+		long loopLag(void) const;
+		/* Ready clients in the last batch, including the ones carried over */
+		size_t queueDepth(void) const;
+		/*
+		* @brief Count the sockets this process has open, and those no client or
+		* listener owns, which leaked
+		*/
+		void countSockets(size_t &open, size_t &leaked) const;
+		/*
+		* @brief Per-address and global limits checked for every accepted socket
+		*/
+		Admission& admission(void);
+		/*
+		* @brief Start a new round of Client::visit marks, every client counts
+		* as unvisited again without touching any of them
+		*/
+		uint64_t nextEpoch(void);
+		/*
+		* @brief Name of this server on the network, hive-<port>.localhost
+		*/
+		const std::string& getName(void) const;
+		void setName(const std::string &name);
+		const std::map<std::string, class Channel>& getChannels(void) const;
+		/*
+		* @brief Create a user introduced by another server
+		* @param route fd of the link the user is reached through
+		* @return the new client, its id is above remoteIdBase
+		*/
+		Client& addRemote(int route);
+		/*
+		* @brief Local or remote user called nick, in any case
+		*/
+		Client* findNick(const std::string &nick);
+		/*
+		* @brief Move fd in the nick index from one name to the other, either
+		* may be empty
+		*/
+		void renameNick(int fd, const Name &from, const Name &to);
+		/*
+		* @brief Send a line to every server link
+		* @param line the message without line ending
+		* @param except fd of the link the message came from, -1 for none
+		*/
+		void propagate(const std::string &line, int except = -1);
+		void addLink(int fd);
+		const std::set<int>& getLinks(void) const;
+		void addServer(const std::string &name, int route);
+		void removeServer(const std::string &name);
+		bool serverExists(const std::string &name) const;
+		const std::map<std::string, int>& getServers(void) const;
 
 };
@@ -0,0 +1,28 @@
+#pragma once
+#include <vector>
+#include <cstddef>
+
+/* Environment variables for running several processes on one port */
+constexpr static const char *shardsEnv = "IRCSERV_SHARDS";
+constexpr static const char *shardPinEnv = "IRCSERV_PIN";
+constexpr static const size_t shardsMax = 256;
+
+/**
+ * @class	Shard
+ * @brief	Runs the server as several processes that share the port
+ *
+ * Every shard is a complete server with its own event loop, clients and
+ * listening socket; SO_REUSEPORT makes the kernel spread new connections
+ * over them. Shard 0 is linked to every other shard over a socketpair with
+ * the server to server protocol, so nicks and channels are known
+ * everywhere and a channel message crosses to each other shard once,
+ * where that shard's own loop delivers it to its members.
+ */
+class	Shard
+{
+	private:
+		Shard(void) = delete;
+
+	public:
+		static size_t	spawn(size_t count, bool pin, std::vector<int> &links);
+};
@@ -0,0 +1,63 @@
+#pragma once
+#include <string>
+#include <ctime>
+#include <cstdint>
+#include <sys/types.h>
+
+/* Where channel state is kept between restarts, and how often it is saved */
+constexpr static const char *snapshotPath = "ircserv.snapshot";
+constexpr static const std::time_t snapshotInterval = 60;
+
+/**
+ * @struct	SnapshotHeader
+ * @brief	Start of a snapshot file, followed by count SnapshotRecords and
+ * the string table
+ */
+struct	SnapshotHeader
+{
+	char		magic[8];
+	uint32_t	version;
+	uint32_t	count;
+	uint64_t	strings;
+	uint64_t	size;
+};
+
+/**
+ * @struct	SnapshotRecord
+ * @brief	One channel, strings are offsets into the string table
+ * @param modes	bit n is set for mode letter 'a' + n
+ */
+struct	SnapshotRecord
+{
+	int64_t		created;
+	uint64_t	limit;
+	uint32_t	modes;
+	uint32_t	name;
+	uint32_t	nameLen;
+	uint32_t	topic;
+	uint32_t	topicLen;
+	uint32_t	key;
+	uint32_t	keyLen;
+	uint32_t	reserved;
+};
+
+/**
+ * @class	Snapshot
+ * @brief	Binary dump of channel names, topics, modes, keys and limits
+ *
+ * The file is a header, an array of fixed size records and a string table,
+ * so loading maps it and reads the records in place. Periodic saves run in a
+ * forked child that writes from its copy-on-write view of the channels while
+ * the event loop carries on.
+ */
+class	Snapshot
+{
+	private:
+		Snapshot(void) = delete;
+		static pid_t	_child;
+
+	public:
+		static void		save(const std::string &path);
+		static bool		write(const std::string &path);
+		static size_t	load(const std::string &path);
+};
@@ -0,0 +1,43 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/**
+ * @class	Socket
+ * @brief	The calls that move client data, counted and replaceable
+ *
+ * Handler and Client read and write client sockets through here only, so a
+ * test harness can install its own functions to fake the network, and
+ * calls() tells how many system calls a workload needed. Install before
+ * the event loop and the fan-out workers start, the functions are read
+ * without a lock.
+ */
+class	Socket
+{
+	public:
+		enum	Call : uint8_t { Recv, Send, Calls };
+
+		struct	Ops
+		{
+			ssize_t	(*recv)(int fd, void *buf, size_t len, int flags);
+			ssize_t	(*send)(int fd, const void *buf, size_t len, int flags);
+			ssize_t	(*sendmsg)(int fd, const struct msghdr *msg, int flags);
+		};
+
+		static ssize_t	recv(int fd, void *buf, size_t len, int flags);
+		static ssize_t	send(int fd, const void *buf, size_t len, int flags);
+		static ssize_t	sendmsg(int fd, const struct msghdr *msg, int flags);
+
+		static void	install(const Ops &ops);
+		static const Ops	&system(void);
+		static size_t	calls(Call call);
+
+	private:
+		Socket(void) = delete;
+
+		static Ops	_ops;
+		static std::atomic<size_t>	_calls[Calls];
+};
@@ -0,0 +1,56 @@
+#pragma once
+#include <string>
+#include <cstddef>
+
+/* Environment variables for the TLS listener, it is off without a port */
+constexpr static const char *tlsPortEnv = "IRCSERV_TLS_PORT";
+constexpr static const char *tlsCertEnv = "IRCSERV_TLS_CERT";
+constexpr static const char *tlsKeyEnv = "IRCSERV_TLS_KEY";
+/* Written by make cert */
+constexpr static const char *tlsCertPath = "ircserv.pem";
+constexpr static const char *tlsKeyPath = "ircserv.key";
+
+struct ssl_st;
+struct bio_st;
+
+/**
+ * @class	Tls
+ * @brief	Server side of a TLS connection, without touching the socket
+ *
+ * The record layer works on memory buffers: bytes received from the socket
+ * go in through decrypt(), plain text the server sends goes in through
+ * encrypt() and the resulting records come out of drain() to be queued on
+ * the client's sendq like any other output. Plain text queued before the
+ * handshake is done stays on the sendq until it is. The handshake advances as its
+ * messages arrive, so it never blocks the event loop. Session tickets and
+ * the session cache let reconnecting clients skip the full handshake.
+ *
+ * Only available when built with make TLS=1, otherwise init() fails.
+ */
+class	Tls
+{
+	private:
+		ssl_st	*_ssl = nullptr;
+		bio_st	*_in = nullptr;
+		bio_st	*_out = nullptr;
+		bool	_established = false;
+
+		bool	_check(int ret);
+
+	public:
+		Tls(void);
+		~Tls(void);
+		Tls(const Tls &) = delete;
+		Tls	&operator=(const Tls &) = delete;
+
+		bool		decrypt(const char *data, size_t len, std::string &plain);
+		bool		encrypt(const std::string &plain);
+		std::string	drain(void);
+		bool		established(void) const;
+
+		static bool			init(const std::string &cert, const std::string &key);
+		static bool			enabled(void);
+		static size_t		fullHandshakes(void);
+		static size_t		resumedHandshakes(void);
+		static size_t		failedHandshakes(void);
+};
@@ -0,0 +1,96 @@
+#pragma once
+#include <ctime>
+#include <array>
+#include <vector>
+#include <cstddef>
+#include <unordered_map>
+#include "Name.hpp"
+
+/* Names one window keeps, a count is overestimated by at most the window
+ * total divided by this */
+constexpr static const size_t topSlots = 64;
+/* Seconds of one window, STATS k reports the last full one plus the current */
+constexpr static const std::time_t topWindow = 60;
+/* Entries of each summary listed by STATS k */
+constexpr static const size_t topShown = 10;
+
+/**
+ * @class	TopK
+ * @brief	The heaviest names of a stream in fixed memory, Space-Saving
+ *
+ * Slots are grouped in buckets of equal count, kept in a list ordered by
+ * count (Stream-Summary). A name already counted is found through a hash
+ * lookup and moves to the bucket of its new count, which for a weight of
+ * one is the next bucket or a new one, so the update is O(1). A new name
+ * takes a slot of the lowest bucket once all are used and inherits its
+ * count as the error bound, so a heavy hitter is never missed. Heavier
+ * weights walk past the buckets they overtake. Counting happens in two
+ * windows that rotate() turns over, so old traffic ages out.
+ */
+class	TopK
+{
+	public:
+		struct	Entry
+		{
+			Name	name;
+			size_t	count;
+			size_t	error;
+		};
+
+		void	add(const Name &name, size_t weight = 1);
+		void	rotate(void);
+		/* The heaviest names of both windows, heaviest first */
+		std::vector<Entry>	top(size_t count) const;
+
+	private:
+		struct	Slot
+		{
+			Name	name;
+			size_t	error = 0;
+			int		bucket = -1;
+			int		prev = -1;
+			int		next = -1;
+		};
+
+		struct	Bucket
+		{
+			size_t	count = 0;
+			int		first = -1;
+			int		prev = -1;
+			int		next = -1;
+		};
+
+		struct	Window
+		{
+			std::array<Slot, topSlots>		slots;
+			std::array<Bucket, topSlots>	buckets;
+			std::unordered_map<Name, int, Name::Hash>	index;
+			size_t	used = 0;
+			int		lowest = -1;
+			int		spare = 0;
+
+			Window(void);
+			int		detach(int slot);
+			void	place(int slot, size_t count, int after);
+			void	raise(int slot, size_t weight);
+			void	collect(std::vector<Entry> &out) const;
+		};
+
+		Window	_current;
+		Window	_previous;
+};
+
+/**
+ * @struct	Hitters
+ * @brief	Who keeps the event loop busy: senders by messages and by bytes
+ * read, channels by bytes queued to their members. Connections without a
+ * nick yet are counted as *@address.
+ */
+struct	Hitters
+{
+	TopK	messages;
+	TopK	bytes;
+	TopK	channels;
+
+	void	rotate(void);
+};
@@ -0,0 +1,30 @@
+#pragma once
+#include <string>
+
+class Server;
+
+/* Environment variable that tells a new binary which socket to resume from */
+constexpr static const char *handoffEnv = "IRCSERV_HANDOFF";
+
+/**
+ * @class	Upgrade
+ * @brief	Hands a running server over to a newly executed binary
+ *
+ * The old process forks and execs its own argv, then sends the listening
+ * socket, every client and link socket with SCM_RIGHTS over a Unix socket,
+ * followed by the state that goes with them: users, partial input lines,
+ * unsent output, remote users, servers and channels with their members.
+ * Once the new process acknowledges, the old one exits without closing any
+ * connection, so clients do not notice the upgrade. TLS sessions cannot be
+ * handed over, those clients quit before the handoff starts.
+ */
+class	Upgrade
+{
+	private:
+		Upgrade(void) = delete;
+
+	public:
+		static bool		start(char **argv);
+		static Server	*resume(int sock, const std::string &port,
+			const std::string &passwd);
+};
@@ -2,30 +2,44 @@
 
 #include <string>
 #include <vector>
+#include <ctime>
+#include "Name.hpp"
 
 using std::string;
 using std::vector;
 
 class Channel;
 
+/*
+ * @class User
+ * @param _prefix :nick!user@host, rebuilt only when one of its parts changes
+ */
 class User {
 	private:
 		vector<Channel*> _channels;
-		string _nick = "";
-		string _user = "";
-		string _hostname = "";
+		Name _nick;
+		Name _user;
+		Name _hostname;
+		string _prefix = ":!@";
+		time_t _signon = time(nullptr);
+		void _updatePrefix(void);
 	public:
 		void join(Channel *chan);
-		void quit(int fd, string msg);
-		void setNick(int filde, string name);
-		void setUser(string name);
-		void setHost(string host);
-		string getNick(void) const;
-		string getUser(void) const;
-		string getHost(void) const;
-		string createPrefix(void) const;
-		Channel* getChannel(string needle);
-		void exitChannel(string needle);
+		void quit(int fd, const string &msg);
+		void notifyPeers(int fd, const string &line);
+		void setNick(int filde, const string &name);
+		void setUser(const string &name);
+		void setHost(const string &host);
+		const string& getNick(void) const;
+		const Name& nickName(void) const;
+		const string& getUser(void) const;
+		const string& getHost(void) const;
+		time_t getSignon(void) const;
+		void setSignon(time_t signon);
+		const string& getPrefix(void) const;
+		Channel* getChannel(const string &needle);
+		const vector<Channel*>& getChannels(void) const;
+		void exitChannel(const string &needle);
 };
 
 #include "Channel.hpp"
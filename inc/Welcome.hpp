@@ -0,0 +1,37 @@
+#pragma once
+#include <string>
+#include <vector>
+
+struct	Settings;
+
+/* Version in 002 and 004, and the MOTD read when motd_file is not set */
+constexpr static const char *serverVersion = "ircserv-1.0";
+constexpr static const char *motdPath = "ircserv.motd";
+
+/**
+ * @class	Welcome
+ * @brief	The registration burst, 001 to 005 and the MOTD, built ahead
+ *
+ * Each block is kept as the text between the places a nick goes, so the
+ * burst for a new client is one allocation that fills in the nick, queued
+ * as one buffer that leaves with a single write. build() runs at startup
+ * and again on every config reload.
+ */
+class	Welcome
+{
+	private:
+		Welcome(void) = delete;
+
+		static std::vector<std::string>	_burst;
+		static std::vector<std::string>	_motd;
+
+		static std::string	_fill(const std::vector<std::string> &pieces,
+			const std::string &nick);
+
+	public:
+		static void	build(const std::string &server, const std::string &created,
+			const Settings &settings);
+		/* 001 to 005 followed by the MOTD */
+		static std::string	burst(const std::string &nick);
+		static std::string	motd(const std::string &nick);
+};
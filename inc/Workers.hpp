@@ -0,0 +1,33 @@
+#pragma once
+#include <cstddef>
+#include <functional>
+
+/* Environment variables for parallel fan-out */
+constexpr static const char *fanoutThreadsEnv = "IRCSERV_FANOUT_THREADS";
+constexpr static const char *fanoutChunkEnv = "IRCSERV_FANOUT_CHUNK";
+/* Recipients per chunk, smaller fan-outs stay on the event loop thread */
+constexpr static const size_t fanoutChunk = 4096;
+constexpr static const size_t fanoutThreadsMax = 16;
+
+/**
+ * @class	Workers
+ * @brief	Thread pool for splitting one long loop of the event loop
+ *
+ * run() hands out task indexes to the pool and to the calling thread and
+ * returns once all of them are done, so the event loop never goes on while
+ * a worker still touches a client. Tasks must only touch state of their own
+ * clients; anything shared has to be collected and applied after run().
+ */
+class	Workers
+{
+	private:
+		Workers(void) = delete;
+
+	public:
+		static void		start(size_t threads);
+		static void		stop(void);
+		static size_t	threads(void);
+		static void		run(size_t tasks, const std::function<void(size_t)> &task);
+		static void		setChunk(size_t members);
+		static size_t	chunk(void);
+};
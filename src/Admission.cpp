@@ -0,0 +1,139 @@
+#include "Admission.hpp"
+#include "Memory.hpp"
+#include <ctime>
+#include <algorithm>
+
+/* Monotonic milliseconds, the coarse clock is enough for rate limits */
+static int64_t	now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return int64_t(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Refill for the time since the last call and take one token
+ * @return false if the bucket is empty
+ */
+bool Admission::Bucket::take(double rate, double burst, int64_t now)
+{
+	if (tokens < 0)
+		tokens = burst;
+	else
+		tokens = std::min(burst, tokens + (now - updated) * rate / 1000);
+	updated = now;
+	if (tokens < 1)
+		return false;
+	tokens -= 1;
+	return true;
+}
+
+/**
+ * Check the limits for a new connection from address and count it when it
+ * is let in
+ */
+Admission::Verdict Admission::admit(int fd, in_addr_t address)
+{
+	int64_t time = now();
+	Verdict verdict = Admit;
+	Entry &entry = _entries[address];
+
+	if (Memory::pressure() >= Memory::Refuse)
+		verdict = MemoryFull;
+	else if (entry.open >= _limits.perAddress)
+		verdict = AddressFull;
+	else if (not entry.bucket.take(_limits.addressRate, _limits.addressBurst, time))
+		verdict = AddressRate;
+	else if (not _global.take(_limits.globalRate, _limits.globalBurst, time))
+		verdict = GlobalRate;
+	if (verdict != Admit)
+	{
+		++_rejected[verdict];
+		return verdict;
+	}
+	track(fd, address);
+	return Admit;
+}
+
+/**
+ * Count a connection that was let in without admit(), like the ones handed
+ * over on upgrade
+ */
+void Admission::track(int fd, in_addr_t address)
+{
+	if (_owners.size() <= size_t(fd))
+		_owners.resize(fd + 1, INADDR_ANY);
+	_owners[fd] = address;
+	++_entries[address].open;
+}
+
+/**
+ * Forget the connection on fd, nothing happens for sockets that were not
+ * counted, like outgoing server links
+ */
+void Admission::release(int fd)
+{
+	if (fd < 0 || size_t(fd) >= _owners.size() || _owners[fd] == INADDR_ANY)
+		return ;
+	if (auto it = _entries.find(_owners[fd]); it != _entries.end() && it->second.open)
+		--it->second.open;
+	_owners[fd] = INADDR_ANY;
+}
+
+/**
+ * Drop addresses with no open connections whose bucket has refilled, they
+ * would start over with a full bucket anyway
+ */
+void Admission::prune(void)
+{
+	int64_t time = now();
+
+	for (auto it = _entries.begin(); it != _entries.end(); )
+	{
+		const Bucket &bucket = it->second.bucket;
+		double tokens = bucket.tokens
+			+ (time - bucket.updated) * _limits.addressRate / 1000;
+		if (it->second.open == 0 && (bucket.tokens < 0 || tokens >= _limits.addressBurst))
+			it = _entries.erase(it);
+		else
+			++it;
+	}
+}
+
+void Admission::setLimits(const AdmitLimits &limits)
+{
+	_limits = limits;
+}
+
+const AdmitLimits &Admission::getLimits(void) const
+{
+	return _limits;
+}
+
+size_t Admission::addresses(void) const
+{
+	return _entries.size();
+}
+
+size_t Admission::rejected(Verdict verdict) const
+{
+	return _rejected[verdict];
+}
+
+const char *Admission::reason(Verdict verdict)
+{
+	switch (verdict)
+	{
+		case AddressFull:
+			return "Too many connections from your host";
+		case AddressRate:
+			return "Connecting too fast from your host";
+		case GlobalRate:
+			return "Server is busy, try again later";
+		case MemoryFull:
+			return "Server is low on memory, try again later";
+		default:
+			return "";
+	}
+}
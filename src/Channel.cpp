@@ -1,6 +1,11 @@
 #include "Channel.hpp"
+#include <algorithm>
 
-Channel::Channel(string channel) : _startTime(time(NULL)), _name(channel), _passwd(), _topic() {
+Channel::Channel(string channel) : _startTime(time(NULL)), _name(channel), _passwd(), _topic(), _roster(channel) {
+}
+
+Channel::~Channel() {
+	Memory::release(Memory::Members, _charged * memberBytes);
 }
 
 bool Channel::isEmpty(void) const {
@@ -12,11 +17,23 @@ void Channel::setPassword(string passwd) {
 }
 
 const string& Channel::getName(void) const {
-	return _name;
+	return _name.str();
+}
+
+bool Channel::hasMode(char mode) const {
+	return _modes & modeBit(mode);
+}
+
+uint32_t Channel::getModes(void) const {
+	return _modes;
 }
 
-const set<char>& Channel::getMode(void) const {
-	return _mode;
+/*
+ * @brief Replace all modes at once, for state restored from a snapshot or
+ * handed over on upgrade
+ */
+void Channel::setModes(uint32_t modes) {
+	_modes = modes & ~modeBit('o');
 }
 
 const set<int>& Channel::getUsers(void) const {
@@ -27,6 +44,10 @@ const set<int>& Channel::getOperators(void) const {
 	return _oper;
 }
 
+const set<int>& Channel::getInvited(void) const {
+	return _invite;
+}
+
 const string& Channel::getTopic(void) const {
 	return _topic;
 }
@@ -39,41 +60,73 @@ const string Channel::getTime(void) const {
 	return std::to_string(_startTime);
 }
 
-bool Channel::setLimit(string limit) {
+time_t Channel::getCreated(void) const {
+	return _startTime;
+}
+
+void Channel::setTime(time_t time) {
+	_startTime = time;
+}
+
+const string& Channel::getPassword(void) const {
+	return _passwd;
+}
+
+bool Channel::parseLimit(const string &limit, size_t &out) {
 	try {
-		_limit = std::stoul(limit);
+		out = std::stoul(limit);
 		return true;
 	} catch (...) {
 		return false;
 	}
 }
 
-void Channel::setMode(string mode) {
-	for (char c : mode) {
-		if (c == 'o')
-			continue;
-		_mode.emplace(c);
-	}
+void Channel::setLimit(size_t limit) {
+	_limit = limit;
 }
 
-void Channel::unsetMode(string umode)  {
-	for (char c : umode) {
-		if (c == 'i')
-			_invite.clear();
-		_mode.erase(c);
+/*
+ * @brief Apply changes that were validated beforehand, none of them can fail
+ * so the channel never ends up half changed. +o and -o move the member
+ * between the member sets instead of setting a mode bit.
+ */
+void Channel::apply(const std::vector<ModeChange> &changes) {
+	for (const ModeChange &change : changes) {
+		if (change.mode == 'o') {
+			change.plus ? promote(change.member) : demote(change.member);
+		} else if (change.plus) {
+			if (change.mode == 'k')
+				_passwd = change.key;
+			else if (change.mode == 'l')
+				_limit = change.limit;
+			_modes |= modeBit(change.mode);
+		} else {
+			if (change.mode == 'i')
+				_invite.clear();
+			_modes &= ~modeBit(change.mode);
+		}
 	}
 }
 
 bool Channel::setTopic(int user, string topic) {
-	if(_mode.contains('t') && not _oper.contains(user)) {
+	if(hasMode('t') && not _oper.contains(user)) {
 		return false;
 	}
 	_topic = topic;
-	string response = ":" + USER(user).getNick() + " TOPIC " + _name + " :" + topic;
+	record(HistoryEntry::Topic, USER(user).getPrefix(), topic);
+	string response = ":" + USER(user).getNick() + " TOPIC " + _name.str() + " :" + topic;
 	message(-1, response);
 	return true;
 }
 
+/*
+ * @brief Set the topic without permission checks or a TOPIC message, for
+ * state that arrives from another server.
+ */
+void Channel::restoreTopic(string topic) {
+	_topic = topic;
+}
+
 bool Channel::checkUser(int user) {
 	if (_users.contains(user) || _oper.contains(user))
 		return false;
@@ -85,16 +138,16 @@ const string Channel::addUser(int user, string passwd) {
 	const string nick = USER(user).getNick();
 	if (not checkUser(user))
 		ret = E443;
-	else if (_mode.contains('l') && _users.size() + _oper.size() >= _limit)
+	else if (hasMode('l') && _users.size() + _oper.size() >= _limit)
 		ret = E471;
-	else if (_mode.contains('i'))
-		if (_mode.contains('k') && joinWithInvite(user, passwd))
+	else if (hasMode('i') && not isEmpty())
+		if (hasMode('k') && joinWithInvite(user, passwd))
 			;
-		else if (_mode.contains('k'))
+		else if (hasMode('k'))
 			ret = E475;
 		else
 			ret = E473;
-	else if (_mode.contains('k'))
+	else if (hasMode('k'))
 		if (joinWithPassword(user, passwd))
 			;
 		else
@@ -102,37 +155,128 @@ const string Channel::addUser(int user, string passwd) {
 	else if (isEmpty()) {
 		_oper.emplace(user);
 		USER(user).join(this);
+		refresh(user);
 	} else {
 		_users.emplace(user);
 		USER(user).join(this);
+		refresh(user);
 	}
 	return ret;
 }
 
 void Channel::removeUser(int fd, string msg, string cmd) {
+	if (checkUser(fd))
+		return ;
+	if (leave(fd))
+		message(fd, msg, cmd);
+}
+
+/*
+ * @brief Take fd off the channel without telling the other members. The
+ * first remaining user becomes operator when the last one leaves.
+ * @return false if fd was the last member and the channel is gone
+ */
+bool Channel::leave(int fd) {
 	if (_users.contains(fd)) {
-		USER(fd).exitChannel(_name);
+		USER(fd).exitChannel(_name.str());
 		_users.erase(fd);
-		message(fd, msg, cmd);
+		refresh(fd);
 	} else if (_oper.contains(fd)) {
-		USER(fd).exitChannel(_name);
+		USER(fd).exitChannel(_name.str());
 		_oper.erase(fd);
-		if  (_oper.empty()) {
+		refresh(fd);
+		if (_oper.empty()) {
 			if (_users.empty()) {
-				irc->removeChannel(_name);
-			} else {
-				auto user = _users.begin();
-				_oper.emplace(*user);
-				_users.erase(*user);
-				message(fd, msg, cmd);
+				irc->removeChannel(_name.str());
+				return false;
 			}
-		} else {
-			message(fd, msg, cmd);
+			int user = *_users.begin();
+			_oper.emplace(user);
+			_users.erase(user);
+			refresh(user);
 		}
-	} else {
-		return ;
 	}
+	return true;
+}
+
+/*
+ * @brief Add a member without mode checks, the server the user is connected
+ * to already allowed the join.
+ * @return false if fd was already on the channel
+ */
+bool Channel::addMember(int fd, bool oper) {
+	if (not checkUser(fd))
+		return false;
+	if (oper)
+		_oper.emplace(fd);
+	else
+		_users.emplace(fd);
+	USER(fd).join(this);
+	refresh(fd);
+	return true;
+}
 
+bool Channel::promote(int fd) {
+	if (not _users.contains(fd))
+		return false;
+	_users.erase(fd);
+	_oper.emplace(fd);
+	refresh(fd);
+	return true;
+}
+
+bool Channel::demote(int fd) {
+	if (not _oper.contains(fd))
+		return false;
+	_oper.erase(fd);
+	_users.emplace(fd);
+	refresh(fd);
+	return true;
+}
+
+/*
+ * @return fd of the member called nick in any case, -1 if there is none
+ */
+int Channel::findMember(const string &nick) const {
+	// A nick that is not interned belongs to nobody, and is not interned here
+	Name folded = Name::lookup(Name::lowercase(nick));
+	if (folded.empty())
+		return -1;
+	for (int fd : _users)
+		if (USER(fd).nickName().fold() == folded)
+			return fd;
+	for (int fd : _oper)
+		if (USER(fd).nickName().fold() == folded)
+			return fd;
+	return -1;
+}
+
+/*
+ * @brief Server links that have members of this channel behind them
+ * @param except link to leave out, the one a message came from
+ */
+set<int> Channel::routes(int except) const {
+	_members();
+	set<int> ret = _links;
+	ret.erase(except);
+	return ret;
+}
+
+void Channel::_members(void) const {
+	if (not _stale)
+		return ;
+	_local.clear();
+	_links.clear();
+	for (const set<int> *members : {&_users, &_oper}) {
+		for (int member : *members) {
+			int route = irc->getClient(member)->route();
+			if (route == -1)
+				_local.push_back(member);
+			else
+				_links.emplace(route);
+		}
+	}
+	_stale = false;
 }
 
 bool Channel::joinWithPassword(int fd, string passwd) {
@@ -142,6 +286,7 @@ bool Channel::joinWithPassword(int fd, string passwd) {
 		else
 			_users.emplace(fd);
 		USER(fd).join(this);
+		refresh(fd);
 		return true;
 	} else {
 		return false;
@@ -150,7 +295,7 @@ bool Channel::joinWithPassword(int fd, string passwd) {
 
 bool Channel::joinWithInvite(int fd, string passwd) {
 	if (_invite.contains(fd)) {
-		if (!_mode.contains('k')) {
+		if (!hasMode('k')) {
 			if (isEmpty()) {
 				_invite.erase(fd);
 				_oper.emplace(fd);
@@ -159,6 +304,7 @@ bool Channel::joinWithInvite(int fd, string passwd) {
 				_users.emplace(fd);
 			}
 			USER(fd).join(this);
+			refresh(fd);
 			return true;
 		} else {
 			if (joinWithPassword(fd, passwd))
@@ -171,49 +317,47 @@ bool Channel::joinWithInvite(int fd, string passwd) {
 	}
 }
 
-string Channel::userList(void) const {
-	string ret;
+/*
+ * @brief Bring the cached NAMES and WHO lines of a member up to date after
+ * a join, part, op or nick change
+ */
+void Channel::refresh(int fd) {
+	size_t members = _users.size() + _oper.size();
+	Memory::charge(Memory::Members, members * memberBytes);
+	Memory::release(Memory::Members, _charged * memberBytes);
+	_charged = members;
+	_stale = true;
+	if (_oper.contains(fd))
+		_roster.add(fd, USER(fd), true);
+	else if (_users.contains(fd))
+		_roster.add(fd, USER(fd), false);
+	else
+		_roster.remove(fd);
+}
 
-	for (auto users : _users) {
-		ret += USER(users).getNick();
-		ret += " ";
-	}
-	for (auto users : _oper) {
-		ret += '@';
-		ret += USER(users).getNick();
-		ret += " ";
-	}
-	ret.erase(ret.end() - 1);
-	return ret;
+/*
+ * @return 353 lines for nick, split to stay within 512 bytes
+ */
+string Channel::names(const string &nick) const {
+	return _roster.names(nick);
+}
+
+string Channel::who(const string &nick) const {
+	return _roster.who(nick);
 }
 
 string Channel::modes(void) const {
 	string ret("+");
 
-	for (auto mode : _mode)
-		ret += mode;
+	for (char mode = 'a'; mode <= 'z'; ++mode)
+		if (hasMode(mode))
+			ret += mode;
 	if (ret.size() == 1)
 		ret.clear();
 
 	return ret;
 }
 
-bool Channel::makeOperator(int fd, string uname) {
-	int newOp = 0;
-
-	for (auto user : _users) {
-		if (USER(user).getNick() == uname) {
-			newOp = user;
-			break ;
-		}
-	}
-	if (!newOp)
-		return false;
-	_users.erase(newOp);
-	_oper.emplace(newOp);
-	return message(-1, PREFIX + " MODE " + _name + " +o " + uname);
-}
-
 void Channel::invite(int fd) {
 	_invite.emplace(fd);
 }
@@ -221,7 +365,8 @@ void Channel::invite(int fd) {
 bool Channel::kick(int op, int user) {
 	if (_users.contains(user) && _oper.contains(op)) {
 		_users.erase(user);
-		USER(user).exitChannel(_name);
+		USER(user).exitChannel(_name.str());
+		refresh(user);
 		return true;
 	} else {
 		return false;
@@ -230,7 +375,6 @@ bool Channel::kick(int op, int user) {
 
 bool Channel::message(int user, string msg, string type, string name) {
 	string message;
-	bool ret = true;
 
 	if (type.empty())
 		message = msg + "\r\n";
@@ -239,17 +383,72 @@ bool Channel::message(int user, string msg, string type, string name) {
 	else
 		message = msg + " " + type + " :" + name + "\r\n";
 
-	for (auto users : _users) {
-		if (users == user)
-			continue;
-		if (-1 == send(users, message.data(), message.size(), 0))
-			ret = false;
+	return deliver(std::make_shared<const string>(std::move(message)), user);
+}
+
+/*
+ * @brief Queue line to the local members but except. With an epoch members
+ * that were visited in it already are skipped. Channels with more members
+ * than Workers::chunk() are split into chunks that the worker threads queue
+ * at the same time; each member is in one chunk and every chunk is done
+ * before this returns, so members still get their lines in order.
+ * @return false if a member could not take the line
+ */
+bool Channel::deliver(const std::shared_ptr<const string> &line, int except,
+	uint64_t epoch) const {
+	_members();
+	irc->hitters().channels.add(_name, line->size() * _local.size());
+	bool ret = true;
+	size_t chunk = Workers::chunk();
+
+	if (_local.size() <= chunk || Workers::threads() == 0) {
+		for (int member : _local) {
+			Client *client = irc->getClient(member);
+			if (member == except || (epoch && not client->visit(epoch)))
+				continue;
+			if (not client->queue(line))
+				ret = false;
+		}
+		return ret;
 	}
-	for (auto users : _oper) {
-		if (users == user)
-			continue;
-		if (-1 == send(users, message.data(), message.size(), 0))
+	size_t chunks = (_local.size() + chunk - 1) / chunk;
+	std::vector<std::vector<int>> queued(chunks), over(chunks);
+	std::vector<char> closing(chunks, 0);
+	Workers::run(chunks, [&](size_t idx) {
+		size_t end = std::min(_local.size(), (idx + 1) * chunk);
+		for (size_t pos = idx * chunk; pos < end; ++pos) {
+			int member = _local[pos];
+			Client *client = irc->getClient(member);
+			if (member == except || (epoch && not client->visit(epoch)))
+				continue;
+			switch (client->push(line)) {
+				case Client::Queued: queued[idx].push_back(member); break;
+				case Client::Over: over[idx].push_back(member); break;
+				case Client::Closing: closing[idx] = 1; break;
+			}
+		}
+	});
+	for (size_t idx = 0; idx < chunks; ++idx) {
+		for (int member : queued[idx])
+			irc->markPending(member);
+		for (int member : over[idx]) {
+			irc->metrics().sendqEvictions++;
+			irc->getClient(member)->evict("SendQ exceeded");
+		}
+		if (closing[idx] || not over[idx].empty())
 			ret = false;
 	}
 	return ret;
 }
+
+/*
+ * @brief Keep an event for CHATHISTORY
+ * @param source prefix of the user the event came from
+ */
+void Channel::record(HistoryEntry::Type type, const string &source, const string &text) {
+	_history.add(type, source, text);
+}
+
+const History& Channel::getHistory(void) const {
+	return _history;
+}
@@ -1,11 +1,42 @@
 #include "Client.hpp"
+#include "Memory.hpp"
+#include "Socket.hpp"
+#include <cerrno>
+#include <algorithm>
+#include <sys/uio.h>
 
-Client::Client(int fd) : _self(User()),  _dispatch(new CommandDispatcher()), _parser(RecvParser(_msg_queue)), _fd(fd) {}
+/* Buffers handed to a single sendmsg() call by flush() */
+constexpr static const size_t iovBatch = 64;
+/* Charged for every client, local or remote */
+constexpr static const size_t clientBytes = sizeof(Client) + sizeof(CommandDispatcher);
+
+Client::Client(int fd, int route) : _self(User()),  _dispatch(new CommandDispatcher()), _parser(RecvParser(_msg_queue)), _route(route), _fd(fd) {
+	Memory::charge(Memory::Clients, clientBytes);
+}
 
 Client::~Client() {
+	_release(_sendqBytes);
+	Memory::release(Memory::Clients, clientBytes);
+	Memory::release(Memory::Recvq, _recvqCharged);
+	Memory::release(Memory::Messages, _messagesCharged);
 	delete _dispatch;
 }
 
+/**
+ * Bring the recvq and parsed message charges up to date after the parser
+ * was fed or messages were taken off its queue
+ */
+void Client::account(void) {
+	size_t recvq = _parser.pending().size(), messages = _parser.queued();
+
+	Memory::charge(Memory::Recvq, recvq);
+	Memory::release(Memory::Recvq, _recvqCharged);
+	Memory::charge(Memory::Messages, messages);
+	Memory::release(Memory::Messages, _messagesCharged);
+	_recvqCharged = recvq;
+	_messagesCharged = messages;
+}
+
 User& Client::getUser(void) {
 	return _self;
 }
@@ -29,6 +60,9 @@ void Client::setHandler(uint32_t eventType, std::function<void(int)> handler) {
 		case EPOLLHUP:
 			_HUP = std::move(handler);
 			break;
+		case EPOLLOUT:
+			_OUT = std::move(handler);
+			break;
 		default:
 			break;
 	}
@@ -42,6 +76,8 @@ bool Client::handler(uint32_t eventType) const {
 			return _RDHUP != nullptr;
 		case EPOLLHUP:
 			return _HUP != nullptr;
+		case EPOLLOUT:
+			return _OUT != nullptr;
 		default:
 			return false;
 	}
@@ -55,6 +91,8 @@ std::function<void(int)>& Client::getHandler(uint32_t eventType) {
 			return _RDHUP;
 		case EPOLLHUP:
 			return _HUP;
+		case EPOLLOUT:
+			return _OUT;
 		default:
 			throw std::runtime_error("Client::getHandler: Error: invalid eventType");
 	}
@@ -71,3 +109,327 @@ bool Client::isAuthenticated(void) const {
 bool& Client::accessRegistered(void){
 	return _registered;
 }
+
+/**
+ * Append a buffer to the send queue. Broadcasts pass the same buffer to every
+ * recipient, the bytes are still counted against each recipient's limits.
+ * @return false if the client is closing or went over its sendq limit
+ */
+bool Client::queue(std::shared_ptr<const std::string> buf) {
+	return _queue(std::move(buf), false);
+}
+
+/**
+ * Queue the answer to a command the client sent itself. NAMES or WHO of a
+ * large channel can be bigger than the hard limit on its own, so answers do
+ * not count against the limits as long as less than the hard limit of
+ * earlier answers is unread; a client that keeps asking without reading is
+ * still evicted.
+ */
+bool Client::reply(std::string msg) {
+	return _queue(std::make_shared<const std::string>(std::move(msg)), true);
+}
+
+bool Client::_queue(std::shared_ptr<const std::string> buf, bool requested) {
+	if (isRemote())
+		return irc->getClient(_route)->queue(std::move(buf));
+	switch (push(std::move(buf), requested)) {
+		case Closing:
+			return false;
+		case Over:
+			irc->metrics().sendqEvictions++;
+			evict("SendQ exceeded");
+			return false;
+		default:
+			irc->markPending(_fd);
+			return true;
+	}
+}
+
+/**
+ * The part of queue() that only touches this client, fan-out workers call
+ * it for different clients at the same time. The caller marks the client
+ * pending, or evicts it when it went over its limits.
+ */
+Client::Push Client::push(std::shared_ptr<const std::string> buf,
+	bool requested) {
+	if (_closing)
+		return Closing;
+	if (buf->empty())
+		return Queued;
+	Metrics &metrics = irc->metrics();
+	if (requested && _requested <= irc->getSendqHard())
+		_requested += buf->size();
+	_sendqBytes += buf->size();
+	Memory::charge(Memory::Sendq, buf->size());
+	_sendq.push_back(std::move(buf));
+	if (_sendqBytes > _sendqPeak) {
+		_sendqPeak = _sendqBytes;
+		// Fan-out workers push to different clients at once, only ever raise it
+		size_t peak = metrics.sendqPeak.load(std::memory_order_relaxed);
+		while (_sendqPeak > peak && not metrics.sendqPeak.compare_exchange_weak(
+			peak, _sendqPeak, std::memory_order_relaxed))
+			;
+	}
+	size_t counted = _sendqBytes - _requested;
+	if (counted > irc->getSendqHard())
+		return Over;
+	if (counted > irc->getSendqSoft()) {
+		std::time_t now = std::time(nullptr);
+		if (not _softSince)
+			_softSince = now;
+		else if (now - _softSince >= irc->getSendqGrace())
+			return Over;
+	}
+	return Queued;
+}
+
+bool Client::queue(std::string msg) {
+	return queue(std::make_shared<const std::string>(std::move(msg)));
+}
+
+void Client::_release(size_t bytes) {
+	_sendqBytes -= bytes;
+	Memory::release(Memory::Sendq, bytes);
+}
+
+/**
+ * Encrypt the plain text at the back of the sendq of a TLS client into one
+ * buffer of records, placed after the records queued before. Until the
+ * handshake is done only handshake messages are queued.
+ * @return false if encryption failed
+ */
+bool Client::_seal(void) {
+	if (not _tls)
+		return true;
+	if (_tls->established() && _sendq.size() > _sealed) {
+		std::string plain;
+		for (auto it = _sendq.begin() + _sealed; it != _sendq.end(); ++it) {
+			plain += **it;
+			_release((*it)->size());
+		}
+		_sendq.erase(_sendq.begin() + _sealed, _sendq.end());
+		if (not _tls->encrypt(plain))
+			return false;
+	}
+	std::string records = _tls->drain();
+	if (records.empty())
+		return true;
+	_sendqBytes += records.size();
+	Memory::charge(Memory::Sendq, records.size());
+	_sendq.insert(_sendq.begin() + _sealed,
+		std::make_shared<const std::string>(std::move(records)));
+	++_sealed;
+	return true;
+}
+
+/**
+ * Write as much of the send queue as the socket takes without blocking.
+ * Whatever is left is written once epoll reports the socket writable again.
+ * @return false on a write error, the connection is unusable after that
+ */
+bool Client::flush(void) {
+	if (isRemote())
+		return true;
+	if (not _seal())
+		return false;
+	while (not _sendq.empty() && (not _tls || _sealed)) {
+		struct iovec iov[iovBatch];
+		size_t count = 0;
+		size_t ready = _tls ? _sealed : _sendq.size();
+		for (auto it = _sendq.begin(); count < ready && count < iovBatch;
+			++it, ++count) {
+			size_t offset = count ? 0 : _sendqOffset;
+			iov[count].iov_base = const_cast<char *>((*it)->data()) + offset;
+			iov[count].iov_len = (*it)->size() - offset;
+		}
+		struct msghdr hdr{};
+		hdr.msg_iov = iov;
+		hdr.msg_iovlen = count;
+		ssize_t sent = Socket::sendmsg(_fd, &hdr, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (sent < 0) {
+			if (errno == EINTR)
+				continue;
+			return errno == EAGAIN || errno == EWOULDBLOCK;
+		}
+		for (size_t left = sent; left; ) {
+			size_t avail = _sendq.front()->size() - _sendqOffset;
+			if (left < avail) {
+				_sendqOffset += left;
+				break;
+			}
+			left -= avail;
+			_requested -= std::min(_requested, _sendq.front()->size());
+			_release(_sendq.front()->size());
+			_sendq.pop_front();
+			_sendqOffset = 0;
+			if (_sealed)
+				--_sealed;
+		}
+		if (_sendqBytes - _requested <= irc->getSendqSoft())
+			_softSince = 0;
+	}
+	return true;
+}
+
+bool Client::hasPending(void) const {
+	return not _sendq.empty();
+}
+
+/**
+ * @return the queued output that was not written yet, as one string
+ */
+std::string Client::pendingOutput(void) const {
+	std::string out;
+
+	for (auto it = _sendq.begin(); it != _sendq.end(); ++it)
+		out.append(**it, it == _sendq.begin() ? _sendqOffset : 0);
+	return out;
+}
+
+size_t Client::sendqBytes(void) const {
+	return _sendqBytes;
+}
+
+/**
+ * @return true once the sendq has been over the soft limit for grace seconds
+ */
+bool Client::sendqExpired(std::time_t now) const {
+	return _softSince && now - _softSince >= irc->getSendqGrace();
+}
+
+size_t Client::sendqPeak(void) const {
+	return _sendqPeak;
+}
+
+/**
+ * Mark the client as reached in the current epoch
+ * @return false if it was reached already
+ */
+bool Client::visit(uint64_t epoch) {
+	if (_visited == epoch)
+		return false;
+	_visited = epoch;
+	return true;
+}
+
+/**
+ * Speak TLS on this connection, called right after accepting it on the TLS
+ * port
+ */
+void Client::startTls(void) {
+	_tls = std::make_unique<Tls>();
+}
+
+bool Client::isTls(void) const {
+	return _tls != nullptr;
+}
+
+/**
+ * Decrypt bytes received on a TLS connection. Handshake replies, and plain
+ * text held back until the handshake is done, are flushed at the end of
+ * the loop iteration.
+ * @return false on a TLS error, the connection is unusable after that
+ */
+bool Client::decrypt(const char *data, size_t len, std::string &plain) {
+	if (not _tls->decrypt(data, len, plain))
+		return false;
+	irc->markPending(_fd);
+	return true;
+}
+
+/**
+ * Drop the queued output and schedule the client for disconnection. Only the
+ * ERROR line is left to send, after a partially written line if there is one.
+ * @param reason shown to the client and used as the QUIT message
+ */
+void Client::evict(const std::string &reason) {
+	if (_closing)
+		return;
+	_closing = true;
+	_closeReason = reason;
+	_requested = 0;
+	while (_sendq.size() > std::max(_sealed, size_t(_sendqOffset ? 1 : 0))) {
+		_release(_sendq.back()->size());
+		_sendq.pop_back();
+	}
+	std::string error = "ERROR :Closing Link: " + _self.getHost()
+		+ " (" + reason + ")\r\n";
+	_sendqBytes += error.size();
+	Memory::charge(Memory::Sendq, error.size());
+	_sendq.push_back(std::make_shared<const std::string>(std::move(error)));
+	irc->markEvicted(_fd);
+}
+
+bool Client::isClosing(void) const {
+	return _closing;
+}
+
+const std::string& Client::closeReason(void) const {
+	return _closeReason;
+}
+
+bool Client::isRemote(void) const {
+	return _route != -1;
+}
+
+int Client::route(void) const {
+	return _route;
+}
+
+bool Client::hasCap(Cap cap) const {
+	return _caps & cap;
+}
+
+void Client::setCaps(uint8_t caps) {
+	_caps = caps;
+}
+
+uint8_t Client::getCaps(void) const {
+	return _caps;
+}
+
+int Client::getFd(void) const {
+	return _fd;
+}
+
+bool Client::isLink(void) const {
+	return _link;
+}
+
+/**
+ * Turn a connection that sent SERVER into a server link, its messages are
+ * dispatched to the link protocol handlers from now on.
+ * @param name the name the peer introduced itself with
+ */
+void Client::makeLink(const std::string &name) {
+	_link = true;
+	_linkPending = false;
+	_server = name;
+}
+
+bool& Client::accessLinkPending(void) {
+	return _linkPending;
+}
+
+const std::string& Client::getServer(void) const {
+	return _server;
+}
+
+void Client::setServer(const std::string &name) {
+	_server = name;
+}
+
+const std::string& Client::getAddress(void) const {
+	return _address;
+}
+
+void Client::setAddress(const std::string &address) {
+	_address = address;
+	_anonymous = Name("*@" + address);
+}
+
+const Name& Client::talker(void) {
+	const Name &nick = _self.nickName();
+	return nick.empty() ? _anonymous : nick;
+}
@@ -1,24 +1,35 @@
 #include "Command.hpp"
+#include "Link.hpp"
+#include "Log.hpp"
+#include "Fanout.hpp"
+#include "Welcome.hpp"
+#include <cstring>
+#include <sys/resource.h>
 
 
 
 
-static void debugLog(const Message &msg)
+static void debugLog(const Message &msg, int fd)
 {
-	std::cerr << "Received unsupported command " << msg.command << " with ";
-	if (msg.prefix)
-		std::cerr << "prefix: " << *msg.prefix << ", ";
-	std::cerr << "params:";
-	for (auto param : msg.params)
-		std::cerr << " " << param;
-	std::cerr << std::endl;
+	Log::debug("Received unsupported command ", msg.command, " fd=", fd,
+		" prefix=", msg.prefix.value_or(""), " params=", msg.params.size());
 }
 
 static void	sendResponse(std::string message, int fd)
 {
 	message.append("\r\n");
-	if (send(fd, message.c_str(), message.size(), 0) < 0)
-		throw (std::runtime_error("Failed to send respond (send)"));
+	irc->getClient(fd)->queue(std::move(message));
+}
+
+/* The regexes only say which characters a name has, its length is up to
+ * nick_max and channel_max */
+static const std::regex	nickname_regex("^[A-Za-z][A-Za-z0-9-_]*");
+static const std::regex	channel_regex("^[#][A-Za-z0-9-_]+");
+
+static bool	validChannel(const std::string &name)
+{
+	return name.size() <= Config::current().channelMax + 1
+		&& std::regex_match(name, channel_regex);
 }
 
 void NickCommand::execute(const Message &msg, int fd)
@@ -28,16 +39,15 @@ void NickCommand::execute(const Message &msg, int fd)
 	const std::string &oldNick = NICK;
 	std::string	newNick = PARAM;
 	User& usr = USER(fd);
-	std::regex nickname_regex("^[A-Za-z][A-Za-z0-9-_]*");
-	if (newNick.size() < 1 || newNick.size() > 9 ||
+	if (newNick.size() < 1 || newNick.size() > Config::current().nickMax ||
 		not std::regex_match(newNick, nickname_regex))
 		return sendResponse(E432, fd);
-	for (auto client : irc->getClients())
-		if (client.second->getUser().getNick() == newNick)
-			return sendResponse(E433, fd);
+	if (Client *owner = irc->findNick(newNick); owner && (owner->_fd != fd || oldNick == newNick))
+		return sendResponse(E433, fd);
 	sendResponse(PREFIX + " NICK :" + newNick, fd);
+	if (irc->getClient(fd)->accessRegistered())
+		irc->propagate(":" + oldNick + " NICK " + newNick);
 	usr.setNick(fd, newNick);
-
 }
 
 void UserCommand::execute(const Message &msg, int fd)
@@ -50,14 +60,9 @@ void UserCommand::execute(const Message &msg, int fd)
 	USER(fd).setHost(PARAM1);
 }
 
-void JoinCommand::execute(const Message &msg, int fd)
+static void joinChannel(const Message &msg, int fd)
 {
-	if (msg.params.size() < 1)
-		return sendResponse(E461, fd);
-	else if (PARAM.empty())
-		return ;
-	std::regex channel_regex("^[#][A-Za-z0-9-_]{1,50}*");
-	if (!std::regex_match(PARAM, channel_regex))
+	if (not validChannel(PARAM))
 		return sendResponse(E403REV2, fd);
 	Channel &channel = irc->addChannel(PARAM);
 	std::string response;
@@ -72,23 +77,40 @@ void JoinCommand::execute(const Message &msg, int fd)
 		sendResponse(R331, fd);
 	else
 		sendResponse(R332, fd);
-	const std::string &names = channel.userList();
-	sendResponse(R353, fd);
-	sendResponse(R366, fd);
-	std::string prefix = PREFIX;
-	for (auto user : channel.getUsers())
-		sendResponse(prefix + " JOIN :" + PARAM, user);
-	for (auto oper : channel.getOperators())
-		sendResponse(prefix + " JOIN :" + PARAM, oper);
+	irc->getClient(fd)->reply(channel.names(NICK) + R366 + "\r\n");
+	channel.message(-1, PREFIX + " JOIN :" + PARAM);
+	channel.record(HistoryEntry::Join, PREFIX);
+	irc->propagate(Link::join(channel, fd));
 }
 
-void PartCommand::execute(const Message &msg, int fd)
+/**
+ * JOIN #a,#b key1,key2 joins every channel with the key at the same position
+ */
+void JoinCommand::execute(const Message &msg, int fd)
 {
 	if (msg.params.size() < 1)
 		return sendResponse(E461, fd);
+	else if (PARAM.empty())
+		return ;
+	std::vector<std::string> channels = splitList(PARAM);
+	if (channels.size() > targmaxChannel)
+		return sendResponse(E407, fd);
+	std::vector<std::string> keys;
+	if (msg.params.size() > 1)
+		keys = splitList(PARAM1, false);
+	for (size_t idx = 0; idx < channels.size(); ++idx)
+	{
+		Message join{msg.prefix, msg.command, {channels[idx]}};
+		if (idx < keys.size())
+			join.params.push_back(keys[idx]);
+		joinChannel(join, fd);
+	}
+}
+
+static void partChannel(const Message &msg, int fd)
+{
 	Client *client = irc->getClient(fd);
-	std::regex channel_regex("^[#][A-Za-z0-9-_]{1,50}*");
-	if (!std::regex_match(PARAM, channel_regex))
+	if (not validChannel(PARAM))
 		return sendResponse(E403REV2, fd);
 	Channel *ch = client->getUser().getChannel(PARAM);
 	if (!ch)
@@ -96,31 +118,71 @@ void PartCommand::execute(const Message &msg, int fd)
 	std::string response = PARAM;
 	if (msg.params.size() > 1)
 		response.append(" :" + PARAM1);
+	ch->record(HistoryEntry::Part, PREFIX, msg.params.size() > 1 ? PARAM1 : "");
 	ch->removeUser(fd, response, "PART");
 	sendResponse(PREFIX + " PART " + response, fd);
+	Link::relay(msg, fd);
 }
 
-void PrivmsgCommand::execute(const Message &msg, int fd)
+void PartCommand::execute(const Message &msg, int fd)
 {
-	if (msg.params.empty())
-		return sendResponse(E411, fd);
-	if (msg.params.size() < 2)
-		return sendResponse(E412, fd);
-	if (PARAM[0] == '#')
+	if (msg.params.size() < 1)
+		return sendResponse(E461, fd);
+	std::vector<std::string> channels = splitList(PARAM);
+	if (channels.size() > targmaxChannel)
+		return sendResponse(E407, fd);
+	for (const std::string &name : channels)
 	{
-		Channel *ch = USER(fd).getChannel(PARAM);
-		if (not ch)
-			return sendResponse(E442, fd);
-		if (not ch->message(fd, PARAM1, "PRIVMSG"))
-			throw (std::runtime_error("Send() failed in PRIVMSG #channel"));
+		Message part = msg;
+		part.params[0] = name;
+		partChannel(part, fd);
 	}
-	else
+}
+
+/**
+ * PRIVMSG and NOTICE to a comma separated list of channels and nicks. NOTICE
+ * never gets an error reply.
+ */
+static void deliver(const Message &msg, int fd, bool replies)
+{
+	if (msg.params.empty())
+		return replies ? sendResponse(E411, fd) : void();
+	if (msg.params.size() < 2)
+		return replies ? sendResponse(E412, fd) : void();
+	std::vector<std::string> targets = splitList(PARAM);
+	if (targets.size() > targmaxMessage)
+		return replies ? sendResponse(E407, fd) : void();
+	Fanout out(*irc->getClient(fd), msg.command, PARAM1);
+	for (const std::string &target : targets)
 	{
-		for (auto client : irc->getClients())
-			if (client.second->getUser().getNick() == PARAM)
-				return sendResponse(PRIVMSG, client.first);
-		sendResponse(E401, fd);
+		if (target[0] == '#')
+		{
+			Channel *ch = USER(fd).getChannel(target);
+			if (ch)
+			{
+				out.channel(*ch);
+				if (msg.command == "PRIVMSG")
+					ch->record(HistoryEntry::Privmsg, PREFIX, PARAM1);
+			}
+			else if (replies)
+				sendResponse(E442, fd);
+		}
+		else if (Client *to = irc->findNick(target))
+			out.user(*to, target);
+		else if (replies)
+			sendResponse(E401, fd);
 	}
+	out.flush();
+}
+
+void PrivmsgCommand::execute(const Message &msg, int fd)
+{
+	deliver(msg, fd, true);
+}
+
+void NoticeCommand::execute(const Message &msg, int fd)
+{
+	deliver(msg, fd, false);
 }
 
 
@@ -136,12 +198,15 @@ void KickCommand::execute(const Message &msg, int fd)
 		return sendResponse(E442, fd);
 	if (not ch->getOperators().contains(fd))
 		return sendResponse(E482, fd);
+	Name victim = Name::lookup(Name::lowercase(PARAM1));
+	if (victim.empty())
+		return sendResponse(E441, fd);
 	for (auto client : ch->getOperators())
-		if (USER(client).getNick() == PARAM1)
+		if (USER(client).nickName().fold() == victim)
 			return sendResponse(E481, fd);
 	Client *target = nullptr;
 	for (auto client : ch->getUsers())
-		if (USER(client).getNick() == PARAM1)
+		if (USER(client).nickName().fold() == victim)
 		{
 			target = irc->getClient(client);
 			break ;
@@ -157,21 +222,14 @@ void KickCommand::execute(const Message &msg, int fd)
 	sendResponse(response, fd);
 	ch->message(fd, response);
 	ch->kick(fd, target->_fd);
+	Link::relay(msg, fd);
 }
 
 void InviteCommand::execute(const Message &msg, int fd)
 {
 	if (msg.params.size() < 2)
 		return sendResponse(E461, fd);
-	Client *target = nullptr;
-	for (auto client : irc->getClients())
-	{
-		if (client.second->getUser().getNick() == PARAM)
-		{
-			target = client.second.get();
-			break ;
-		}
-	}
+	Client *target = irc->findNick(PARAM);
 	if (not target)
 		return sendResponse(E401, fd);
 	if (target->_fd == fd)
@@ -182,7 +240,7 @@ void InviteCommand::execute(const Message &msg, int fd)
 		if (not ch->getUsers().contains(fd) &&
 			not ch->getOperators().contains(fd))
 			return sendResponse(E442, fd);
-		else if (ch->getMode().contains('i') &&
+		else if (ch->hasMode('i') &&
 			not ch->getOperators().contains(fd))
 			return sendResponse(E482, fd);
 		else if (ch->getUsers().contains(target->_fd) ||
@@ -211,13 +269,14 @@ void TopicCommand::execute(const Message &msg, int fd)
 			return sendResponse(R331, fd);
 		return sendResponse(R332, fd);
 	}
-	if (ch->getMode().contains('t') &&
+	if (ch->hasMode('t') &&
 		not ch->getOperators().contains(fd))
 		return sendResponse(E482, fd);
-	ch->setTopic(fd, PARAM1);
+	if (ch->setTopic(fd, PARAM1))
+		Link::relay(msg, fd);
 }
 
-constexpr std::string supported = "itkol", required = "klo";
+constexpr std::string supported = "itkol", required = "kl";
 
 void ModeCommand::execute(const Message &msg, int fd)
 {
@@ -230,60 +289,64 @@ void ModeCommand::execute(const Message &msg, int fd)
 			return sendResponse(R329, fd);
 		} else if (!ch->getOperators().contains(fd))
 			return sendResponse(E482, fd);
-		std::string input = PARAM1, enable, disable;
+		std::vector<ModeChange> changes;
+		std::string enable, disable;
 		bool plus, valid = true;
-		for (auto c = input.begin(); c != input.end(); )
+		for (auto c = PARAM1.begin(); c != PARAM1.end(); )
 		{
 			if ((*c == '+'|| *c == '-') && valid) {
 				plus = (*c == '+');
 				++c;
-				for (valid = false; c != input.end() &&
+				for (valid = false; c != PARAM1.end() &&
 					std::isalpha(*c); c++) {
-					plus ? enable += *c : disable += *c;
+					std::string &seen = plus ? enable : disable;
+					if (supported.find(*c) == std::string::npos
+						|| seen.find(*c) != std::string::npos)
+						return sendResponse(E472, fd);
+					seen += *c;
+					changes.push_back({*c, plus});
 					valid = true;
 				}
 			} else
 				return sendResponse(E472, fd);
 		}
 		size_t paramsNeeded = 2;
-		for (auto c = enable.begin(); c != enable.end(); ++c)
-		{
-			if ((supported.find(*c) == std::string::npos)
-				|| (std::find(c + 1, enable.end(), *c) != enable.end()))
-				return sendResponse(E472, fd);
-			else if (required.find(*c) != std::string::npos)
+		for (const ModeChange &change : changes)
+			if (change.mode == 'o' || (change.plus &&
+				required.find(change.mode) != std::string::npos))
 				paramsNeeded++;
-		}
-		for (auto c = disable.begin(); c != disable.end(); ++c)
-		{
-			if ((supported.find(*c) == std::string::npos)||
-				(std::find(c + 1, disable.end(), *c) != disable.end()))
-				return sendResponse(E472, fd);
-		}
 		if (msg.params.size() < paramsNeeded)
 			return sendResponse(E461, fd);
-		Channel backup = *ch;
-		int index = 2;
-		for (auto c : enable)
+		size_t index = 2;
+		for (ModeChange &change : changes)
 		{
-			if (c == 'k') {
-				ch->setPassword(msg.params[index++]);
-			} else if (c == 'l' &&
-				not ch->setLimit(msg.params[index++])) {
-				*ch = backup;
+			if (change.mode == 'o') {
+				change.member = ch->findMember(msg.params[index++]);
+				const std::set<int> &from = change.plus ?
+					ch->getUsers() : ch->getOperators();
+				if (not from.contains(change.member))
+					return sendResponse(E441, fd);
+			} else if (not change.plus ||
+				required.find(change.mode) == std::string::npos)
+				continue ;
+			else if (change.mode == 'k')
+				change.key = msg.params[index++];
+			else if (not Channel::parseLimit(msg.params[index++], change.limit))
 				return ;
-			} else if (c == 'o' &&
-				not ch->makeOperator(fd, msg.params[index++])) {
-				sendResponse(E441, fd);
-				*ch = backup;
-				return ;
-			}
 		}
-		if (disable.empty() && enable == "o")
-			return ;
-		ch->setMode(enable);
-		ch->unsetMode(disable);
-		ch->message(-1, R324);
+		ch->apply(changes);
+		Link::relay(msg, fd);
+		bool modes = false;
+		for (const ModeChange &change : changes)
+		{
+			if (change.mode != 'o')
+				modes = true;
+			else
+				ch->message(-1, PREFIX + " MODE " + PARAM + (change.plus ? " +o " : " -o ")
+					+ USER(change.member).getNick());
+		}
+		if (modes)
+			ch->message(-1, R324);
 	};
 
 	auto user = [&]() {
@@ -311,6 +374,26 @@ void CapCommand::execute(const Message &msg, int fd)
 		return sendResponse(CAP461, fd);
 	if (PARAM == "LS")
 		return sendResponse(CAP, fd);
+	else if (PARAM == "REQ")
+	{
+		// All or nothing: any unknown name refuses the whole request
+		Client *client = irc->getClient(fd);
+		const std::string list = msg.params.size() > 1 ? PARAM1 : "";
+		std::istringstream names(list);
+		uint8_t caps = client->getCaps();
+		for (std::string name; names >> name; )
+		{
+			bool off = name[0] == '-';
+			const std::string cap = name.substr(off);
+			uint8_t bit = cap == "batch" ? Client::Batch
+				: cap == "server-time" ? Client::ServerTime : 0;
+			if (not bit)
+				return sendResponse(":localhost CAP * NAK :" + list, fd);
+			caps = off ? caps & ~bit : caps | bit;
+		}
+		client->setCaps(caps);
+		return sendResponse(":localhost CAP * ACK :" + list, fd);
+	}
 	else if (PARAM == "END")
 		return ;
 	else
@@ -326,22 +409,23 @@ void WhoisCommand::execute(const Message &msg, int fd)
 void WhoCommand::execute(const Message &msg, int fd)
 {
 	if (msg.params.empty())
-		sendResponse(E461, fd);
+		return sendResponse(E461, fd);
 	Channel *ch = USER(fd).getChannel(PARAM);
 	if (not ch)
 		return sendResponse(E442, fd);
 	const std::string &nick = NICK;
-	for (auto id : ch->getUsers())
-	{
-		const User& user = USER(id);
-		sendResponse(R352, fd);
-	}
-	for (auto id : ch->getOperators())
-	{
-		const User& user = USER(id);
-		sendResponse(R352 + " @", fd);
-	}
-	sendResponse(R315, fd);
+	irc->getClient(fd)->reply(ch->who(nick) + R315 + "\r\n");
+}
+
+void NamesCommand::execute(const Message &msg, int fd)
+{
+	if (msg.params.empty())
+		return sendResponse(E461, fd);
+	Channel *ch = irc->findChannel(PARAM);
+	if (ch && (ch->getUsers().contains(fd) || ch->getOperators().contains(fd)))
+		irc->getClient(fd)->reply(ch->names(NICK) + R366 + "\r\n");
+	else
+		sendResponse(R366, fd);
 }
 
 void PingCommand::execute(const Message &msg, int fd)
@@ -358,8 +442,292 @@ void PassCommand::execute(const Message &msg, int fd)
 	sendResponse(E464, fd);
 }
 
+void MotdCommand::execute(const Message &msg, int fd)
+{
+	(void)msg;
+	irc->getClient(fd)->queue(Welcome::motd(NICK));
+}
+
+/* Clients listed with their sendq high-water mark by STATS q */
+constexpr size_t statsTopClients = 10;
+
+/* STATS letters that name users or channels, or scan every descriptor,
+ * answered only to clients on the server host like CONNECT */
+constexpr const char *statsPrivate = "cfhkmq";
+
+void StatsCommand::execute(const Message &msg, int fd)
+{
+	const std::string query = msg.params.empty() ? "q" : PARAM.substr(0, 1);
+	if (not irc->getClient(fd)->accessRegistered())
+		return sendResponse(E451, fd);
+	if (query.empty() || std::strchr(statsPrivate, query[0]))
+		if (irc->getClient(fd)->getAddress() != "127.0.0.1")
+			return sendResponse(E481, fd);
+	if (query == "q")
+	{
+		const Metrics &metrics = irc->metrics();
+		sendResponse(R249 + "sendq soft " + std::to_string(irc->getSendqSoft())
+			+ " hard " + std::to_string(irc->getSendqHard())
+			+ " grace " + std::to_string(irc->getSendqGrace()), fd);
+		sendResponse(R249 + "sendq queued " + std::to_string(Memory::used(Memory::Sendq))
+			+ " peak " + std::to_string(metrics.sendqPeak)
+			+ " evictions " + std::to_string(metrics.sendqEvictions), fd);
+		sendResponse(R249 + "recvq limit " + std::to_string(Config::current().recvq)
+			+ " evictions " + std::to_string(metrics.recvqEvictions)
+			+ " overlong " + std::to_string(metrics.overlongLines), fd);
+		std::vector<Client *> clients;
+		for (auto &client : irc->getClients())
+			clients.push_back(client.second.get());
+		size_t top = std::min(statsTopClients, clients.size());
+		std::partial_sort(clients.begin(), clients.begin() + top, clients.end(),
+			[](Client *a, Client *b) {
+				return a->sendqPeak() > b->sendqPeak();
+			});
+		for (size_t idx = 0; idx < top; ++idx)
+		{
+			Client *client = clients[idx];
+			sendResponse(R249 + "sendq " + client->getUser().getNick()
+				+ " queued " + std::to_string(client->sendqBytes())
+				+ " peak " + std::to_string(client->sendqPeak()), fd);
+		}
+	}
+	else if (query == "l")
+	{
+		sendResponse(R249 + "log level " + Log::levelName(Log::level())
+			+ " dropped " + std::to_string(Log::dropped())
+			+ " suppressed " + std::to_string(Log::suppressed()), fd);
+	}
+	else if (query == "a")
+	{
+		const Admission &admission = irc->admission();
+		const AdmitLimits &limits = admission.getLimits();
+		sendResponse(R249 + "admit per-address " + std::to_string(limits.perAddress)
+			+ " rate " + std::to_string(int(limits.addressRate))
+			+ "/" + std::to_string(int(limits.addressBurst))
+			+ " global " + std::to_string(int(limits.globalRate))
+			+ "/" + std::to_string(int(limits.globalBurst)), fd);
+		sendResponse(R249 + "admit addresses " + std::to_string(admission.addresses())
+			+ " full " + std::to_string(admission.rejected(Admission::AddressFull))
+			+ " address-rate " + std::to_string(admission.rejected(Admission::AddressRate))
+			+ " global-rate " + std::to_string(admission.rejected(Admission::GlobalRate))
+			+ " memory " + std::to_string(admission.rejected(Admission::MemoryFull)), fd);
+	}
+	else if (query == "f")
+	{
+		size_t open = 0, leaked = 0;
+		irc->countSockets(open, leaked);
+		const Metrics &metrics = irc->metrics();
+		sendResponse(R249 + "fds sockets " + std::to_string(open)
+			+ " leaked " + std::to_string(leaked)
+			+ " closed " + std::to_string(metrics.closed)
+			+ " hangups " + std::to_string(metrics.hangups), fd);
+	}
+	else if (query == "t")
+	{
+		sendResponse(R249 + "tls " + (Tls::enabled() ? "on" : "off")
+			+ " full " + std::to_string(Tls::fullHandshakes())
+			+ " resumed " + std::to_string(Tls::resumedHandshakes())
+			+ " failed " + std::to_string(Tls::failedHandshakes()), fd);
+	}
+	else if (query == "c")
+	{
+		const Settings &settings = Config::current();
+		sendResponse(R249 + "config " + Config::path()
+			+ " reloads " + std::to_string(Config::reloads())
+			+ " epoll-events " + std::to_string(settings.epollEvents)
+			+ " backlog " + std::to_string(settings.backlog)
+			+ " recv-buffer " + std::to_string(settings.recvBuffer)
+			+ " line-max " + std::to_string(settings.lineMax)
+			+ " fanout-threads " + std::to_string(Workers::threads()), fd);
+	}
+	else if (query == "m")
+	{
+		std::string used;
+		for (uint8_t kind = 0; kind < Memory::Kinds; ++kind)
+			used += std::string(" ") + Memory::name(Memory::Kind(kind)) + " "
+				+ std::to_string(Memory::used(Memory::Kind(kind)));
+		sendResponse(R249 + "memory" + used, fd);
+		const Metrics &metrics = irc->metrics();
+		sendResponse(R249 + "memory total " + std::to_string(Memory::total())
+			+ " budget " + std::to_string(Memory::budget())
+			+ " trims " + std::to_string(metrics.memoryTrims)
+			+ " evictions " + std::to_string(metrics.memoryEvictions)
+			+ " refused " + std::to_string(irc->admission().rejected(Admission::MemoryFull)), fd);
+	}
+	else if (query == "e")
+	{
+		const Metrics &metrics = irc->metrics();
+		struct rusage usage{};
+		getrusage(RUSAGE_SELF, &usage);
+		sendResponse(R249 + "events batch " + std::to_string(irc->eventBatch())
+			+ " grows " + std::to_string(metrics.epollGrows)
+			+ " busy-poll " + std::to_string(Config::current().busyPoll)
+			+ " spin-hits " + std::to_string(metrics.spinHits)
+			+ " spin-misses " + std::to_string(metrics.spinMisses)
+			+ " lag-us " + std::to_string(irc->loopLag())
+			+ " depth " + std::to_string(irc->queueDepth())
+			+ " shed " + std::to_string(metrics.shedCommands)
+			+ " cpu-user " + std::to_string(usage.ru_utime.tv_sec * 1000 + usage.ru_utime.tv_usec / 1000)
+			+ " cpu-sys " + std::to_string(usage.ru_stime.tv_sec * 1000 + usage.ru_stime.tv_usec / 1000), fd);
+	}
+	else if (query == "k")
+	{
+		Hitters &hitters = irc->hitters();
+		for (auto [name, top] : {std::pair{"messages", &hitters.messages},
+			{"bytes", &hitters.bytes}, {"channel-bytes", &hitters.channels}})
+			for (const TopK::Entry &entry : top->top(topShown))
+				sendResponse(R249 + "top " + name + " " + entry.name.str()
+					+ " " + std::to_string(entry.count)
+					+ " error " + std::to_string(entry.error), fd);
+	}
+	else if (query == "h")
+	{
+		sendResponse(R249 + "history bytes " + std::to_string(History::total())
+			+ " budget " + std::to_string(historyBudget)
+			+ " names " + std::to_string(Name::count())
+			+ " evicted " + std::to_string(History::evicted()), fd);
+	}
+	sendResponse(R219, fd);
+}
+
+/* Batch references only have to be unique on one connection */
+static size_t historyBatch = 0;
+
+static std::string	serverTime(int64_t ms)
+{
+	std::time_t secs = ms / 1000;
+	struct tm tm{};
+	char buf[32];
+
+	gmtime_r(&secs, &tm);
+	size_t len = std::strftime(buf, sizeof(buf), "%Y-%m-%dT%H:%M:%S", &tm);
+	std::snprintf(buf + len, sizeof(buf) - len, ".%03dZ", int(ms % 1000));
+	return buf;
+}
+
+/* @return milliseconds of a timestamp= selector, -1 if it is not one */
+static int64_t	selectorTime(const std::string &selector)
+{
+	const std::string key = "timestamp=";
+	struct tm tm{};
+
+	if (selector.compare(0, key.size(), key))
+		return -1;
+	const char *rest = strptime(selector.c_str() + key.size(), "%Y-%m-%dT%H:%M:%S", &tm);
+	if (not rest)
+		return -1;
+	int64_t ms = int64_t(timegm(&tm)) * 1000;
+	if (*rest == '.')
+		for (int64_t unit = 100; unit && std::isdigit(*++rest); unit /= 10)
+			ms += (*rest - '0') * unit;
+	return ms;
+}
+
+/**
+ * CHATHISTORY LATEST|BEFORE|AFTER|AROUND|BETWEEN <#channel> <selectors>
+ * <limit> replays events kept by the channel, in a chathistory batch and
+ * with time tags for clients that enabled batch and server-time. Only
+ * timestamp= selectors are supported, there are no message ids.
+ */
+void ChathistoryCommand::execute(const Message &msg, int fd)
+{
+	const std::string fail = "FAIL CHATHISTORY ";
+	if (msg.params.size() < 4)
+		return sendResponse(fail + "INVALID_PARAMS :Missing parameters", fd);
+	const std::string &sub = PARAM;
+	const std::string &target = PARAM1;
+	const bool between = sub == "BETWEEN";
+	if (between && msg.params.size() < 5)
+		return sendResponse(fail + "INVALID_PARAMS :Missing parameters", fd);
+	Channel *ch = USER(fd).getChannel(target);
+	if (not ch)
+		return sendResponse(fail + "INVALID_TARGET " + sub + " " + target
+			+ " :You're not on that channel", fd);
+	const std::string &count = msg.params[between ? 4 : 3];
+	size_t limit = std::min<size_t>(std::atol(count.c_str()), historyReplyMax);
+	int64_t from = selectorTime(PARAM2);
+	int64_t to = between ? selectorTime(msg.params[3]) : 0;
+	if (limit == 0 || to == -1 || (from == -1 && not (sub == "LATEST" && PARAM2 == "*")))
+		return sendResponse(fail + "INVALID_PARAMS " + sub + " :Invalid parameters", fd);
+
+	const std::deque<HistoryEntry> &entries = ch->getHistory().entries();
+	auto before = [&](int64_t time) {
+		return std::lower_bound(entries.begin(), entries.end(), time,
+			[](const HistoryEntry &entry, int64_t time) { return entry.time < time; });
+	};
+	auto after = [&](int64_t time) {
+		return std::upper_bound(entries.begin(), entries.end(), time,
+			[](int64_t time, const HistoryEntry &entry) { return time < entry.time; });
+	};
+	auto first = entries.begin(), last = entries.end();
+	if (sub == "LATEST" || sub == "BEFORE")
+	{
+		if (sub == "BEFORE")
+			last = before(from);
+		else if (from != -1)
+			first = after(from);
+		first = std::max(first, last - std::min<ptrdiff_t>(limit, last - first));
+	}
+	else if (sub == "AFTER")
+	{
+		first = after(from);
+		last = first + std::min<ptrdiff_t>(limit, last - first);
+	}
+	else if (sub == "AROUND")
+	{
+		auto mid = before(from);
+		first = mid - std::min<ptrdiff_t>(limit / 2, mid - first);
+		last = first + std::min<ptrdiff_t>(limit, last - first);
+	}
+	else if (between)
+	{
+		first = after(std::min(from, to));
+		last = std::max(first, before(std::max(from, to)));
+		if (from <= to)
+			last = first + std::min<ptrdiff_t>(limit, last - first);
+		else
+			first = last - std::min<ptrdiff_t>(limit, last - first);
+	}
+	else
+		return sendResponse(fail + "INVALID_PARAMS " + sub + " :Unknown subcommand", fd);
+
+	// Tags only go to clients that asked for them, others get plain lines
+	Client *client = irc->getClient(fd);
+	const bool batched = client->hasCap(Client::Batch);
+	const bool timed = client->hasCap(Client::ServerTime);
+	const std::string batch = batched ? std::to_string(++historyBatch) : "";
+	if (batched)
+		sendResponse(":localhost BATCH +" + batch + " chathistory " + target, fd);
+	for (auto it = first; it != last; ++it)
+	{
+		std::string tags;
+		if (batched)
+			tags = "batch=" + batch;
+		if (timed)
+			tags += (tags.empty() ? "" : ";") + std::string("time=") + serverTime(it->time);
+		sendResponse((tags.empty() ? "" : "@" + tags + " ")
+			+ History::format(*it, ch->getName()), fd);
+	}
+	if (batched)
+		sendResponse(":localhost BATCH -" + batch, fd);
+}
+
+/**
+ * CONNECT <host> <port> links this server to another one. There are no IRC
+ * operators, so only users connected from the same machine may use it.
+ */
+void ConnectCommand::execute(const Message &msg, int fd)
+{
+	if (msg.params.size() < 2)
+		return sendResponse(E461, fd);
+	if (irc->getClient(fd)->getAddress() != "127.0.0.1")
+		return sendResponse(E481, fd);
+	Link::connect(PARAM, PARAM1);
+	sendResponse("NOTICE " + NICK + " :Connecting to " + PARAM + " " + PARAM1, fd);
+}
+
 void UnknownCommand::execute(const Message &msg, int fd)
 {
-	debugLog(msg);
+	debugLog(msg, fd);
 	sendResponse(E421, fd);
 }
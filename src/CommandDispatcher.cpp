@@ -1,27 +1,83 @@
 #include "CommandDispatcher.hpp"
+#include "Link.hpp"
+#include "Log.hpp"
+#include "Welcome.hpp"
 #include <memory>
 
 /**
- * CommandDispatcher installs seperate handlers for each command at construction
+ * Commands keep no state, so all clients share one table of handlers that
+ * is built the first time it is needed instead of one per connection
  */
-CommandDispatcher::CommandDispatcher(void)
+static const CommandDispatcher::Handlers	&clientHandlers(void)
 {
-	_handlers["NICK"] = std::make_unique<NickCommand>();
-	_handlers["USER"] = std::make_unique<UserCommand>();
-	_handlers["JOIN"] = std::make_unique<JoinCommand>();
-	_handlers["PART"] = std::make_unique<PartCommand>();
-	_handlers["PRIVMSG"] = std::make_unique<PrivmsgCommand>();
-	_handlers["KICK"] = std::make_unique<KickCommand>();
-	_handlers["INVITE"] = std::make_unique<InviteCommand>();
-	_handlers["TOPIC"] = std::make_unique<TopicCommand>();
-	_handlers["MODE"] = std::make_unique<ModeCommand>();
-	_handlers["QUIT"] = std::make_unique<QuitCommand>();
-	_handlers["CAP"] = std::make_unique<CapCommand>();
-	_handlers["WHOIS"] = std::make_unique<WhoisCommand>();
-	_handlers["WHO"] = std::make_unique<WhoCommand>();
-	_handlers["PING"] = std::make_unique<PingCommand>();
-	_handlers["PASS"] = std::make_unique<PassCommand>();
-	_handlers["UNKNOWN"] = std::make_unique<UnknownCommand>();
+	static const CommandDispatcher::Handlers handlers = [] {
+		CommandDispatcher::Handlers table;
+		table["NICK"] = std::make_unique<NickCommand>();
+		table["USER"] = std::make_unique<UserCommand>();
+		table["JOIN"] = std::make_unique<JoinCommand>();
+		table["PART"] = std::make_unique<PartCommand>();
+		table["PRIVMSG"] = std::make_unique<PrivmsgCommand>();
+		table["NOTICE"] = std::make_unique<NoticeCommand>();
+		table["KICK"] = std::make_unique<KickCommand>();
+		table["INVITE"] = std::make_unique<InviteCommand>();
+		table["TOPIC"] = std::make_unique<TopicCommand>();
+		table["MODE"] = std::make_unique<ModeCommand>();
+		table["QUIT"] = std::make_unique<QuitCommand>();
+		table["CAP"] = std::make_unique<CapCommand>();
+		table["WHOIS"] = std::make_unique<WhoisCommand>();
+		table["WHO"] = std::make_unique<WhoCommand>();
+		table["NAMES"] = std::make_unique<NamesCommand>();
+		table["PING"] = std::make_unique<PingCommand>();
+		table["PASS"] = std::make_unique<PassCommand>();
+		table["MOTD"] = std::make_unique<MotdCommand>();
+		table["STATS"] = std::make_unique<StatsCommand>();
+		table["CHATHISTORY"] = std::make_unique<ChathistoryCommand>();
+		table["CONNECT"] = std::make_unique<ConnectCommand>();
+		table["SERVER"] = std::make_unique<ServerCommand>();
+		table["UNKNOWN"] = std::make_unique<UnknownCommand>();
+		return table;
+	}();
+	return handlers;
+}
+
+/**
+ * The server to server protocol handlers, used once a connection has
+ * registered as a server link
+ */
+static const CommandDispatcher::Handlers	&linkHandlers(void)
+{
+	static const CommandDispatcher::Handlers handlers = [] {
+		CommandDispatcher::Handlers table;
+		table["SERVER"] = std::make_unique<LinkServerCommand>();
+		table["SQUIT"] = std::make_unique<LinkSquitCommand>();
+		table["NICK"] = std::make_unique<LinkNickCommand>();
+		table["SJOIN"] = std::make_unique<LinkSjoinCommand>();
+		table["PART"] = std::make_unique<LinkPartCommand>();
+		table["PRIVMSG"] = std::make_unique<LinkPrivmsgCommand>();
+		table["NOTICE"] = std::make_unique<LinkPrivmsgCommand>();
+		table["QUIT"] = std::make_unique<LinkQuitCommand>();
+		table["KILL"] = std::make_unique<LinkKillCommand>();
+		table["MODE"] = std::make_unique<LinkModeCommand>();
+		table["TOPIC"] = std::make_unique<LinkTopicCommand>();
+		table["KICK"] = std::make_unique<LinkKickCommand>();
+		table["INVITE"] = std::make_unique<LinkInviteCommand>();
+		table["ERROR"] = std::make_unique<LinkErrorCommand>();
+		return table;
+	}();
+	return handlers;
+}
+
+/**
+ * Commands whose cost grows with channel sizes or the number of clients and
+ * descriptors, turned away while the event loop is overloaded. PING, PONG
+ * and messages always go through.
+ */
+static bool	expensive(const Message &msg)
+{
+	if (msg.command == "WHO" || msg.command == "NAMES" || msg.command == "STATS")
+		return true;
+	return msg.command == "JOIN" && not msg.params.empty()
+		&& msg.params[0].find(',') != std::string::npos;
 }
 
 /**
@@ -32,7 +88,14 @@ bool	CommandDispatcher::dispatch(const std::unique_ptr<Message> &msg, int fd)
 {
 	try
 	{
-		if (auto cmd = _handlers.find(msg->command); cmd != _handlers.end())
+		if (irc->getClient(fd)->isLink())
+		{
+			if (auto cmd = linkHandlers().find(msg->command);
+				cmd != linkHandlers().end())
+				cmd->second->execute(*msg, fd);
+			return (true);
+		}
+		if (auto cmd = clientHandlers().find(msg->command); cmd != clientHandlers().end())
 		{
 			if ((not irc->checkPassword() &&
 				not irc->getClient(fd)->isAuthenticated() &&
@@ -42,11 +105,19 @@ bool	CommandDispatcher::dispatch(const std::unique_ptr<Message> &msg, int fd)
 				not msg->params.empty() &&
 				not irc->checkPassword(msg->params[0])))
 			{
+				Client *client = irc->getClient(fd);
 				std::string response(E464);
-				send(fd, response.data(), response.size(), 0);
-				irc->removeClient(fd);
+				client->queue(response + "\r\n");
+				client->flush();
+				client->evict("Bad password");
 				return false;
 			}
+			if (irc->overloaded() && expensive(*msg))
+			{
+				irc->metrics().shedCommands++;
+				irc->getClient(fd)->queue(R263 + "\r\n");
+				return (true);
+			}
 			if (msg->command == "QUIT")
 				return cmd->second->execute(*msg, fd), false;
 			cmd->second->execute(*msg, fd);
@@ -56,11 +127,11 @@ bool	CommandDispatcher::dispatch(const std::unique_ptr<Message> &msg, int fd)
 				_welcome(fd);
 		}
 		else
-			_handlers.find("UNKNOWN")->second->execute(*msg, fd);
+			clientHandlers().find("UNKNOWN")->second->execute(*msg, fd);
 	}
 	catch (std::exception &e)
 	{
-		std::cerr << "Command dispatcher error: " << e.what() << std::endl;
+		Log::error("Command dispatcher error: ", e.what());
 	}
 	return (true);
 }
@@ -68,15 +139,6 @@ bool	CommandDispatcher::dispatch(const std::unique_ptr<Message> &msg, int fd)
 void	CommandDispatcher::_welcome(int fd)
 {
 	irc->getClient(fd)->accessRegistered() = true;
-	std::string nick = irc->getClient(fd)->getUser().getNick();
-	std::string response = "001 " + nick + " :Welcome to Hive network\r\n";
-	send(fd, response.c_str(), response.size(), 0);
-	response = "002 " + nick + " :Your hostname is " +
-		irc->getClient(fd)->getUser().getHost() + "\r\n";
-	send(fd, response.c_str(), response.size(), 0);
-	response = "003 " + nick + " :This server was started " + irc->getTime() + "\r\n";
-	send(fd, response.c_str(), response.size(), 0);
-	response = "004 " + nick + " :Your username is " +
-		irc->getClient(fd)->getUser().getUser() + "\r\n";
-	send(fd, response.c_str(), response.size(), 0);
+	irc->propagate(Link::introduce(*irc->getClient(fd)));
+	irc->getClient(fd)->queue(Welcome::burst(irc->getClient(fd)->getUser().getNick()));
 }
@@ -0,0 +1,303 @@
+#include "Config.hpp"
+#include "Shard.hpp"
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <strings.h>
+
+Settings	Config::_current;
+std::string	Config::_path;
+size_t		Config::_reloads = 0;
+
+using Setter = std::function<bool(Settings &, const std::string &)>;
+
+struct	Key
+{
+	const char	*name;
+	Setter		set;
+};
+
+/**
+ * Parse a whole number with an optional k, m or g suffix
+ * @return false if text is not a number or outside min and max
+ */
+static bool	parseSize(const std::string &text, size_t &out, size_t min, size_t max)
+{
+	char *end = nullptr;
+	errno = 0;
+	unsigned long long value = std::strtoull(text.c_str(), &end, 10);
+	if (end == text.c_str() || text[0] == '-' || errno)
+		return false;
+	static const char units[] = "kmg";
+	if (*end && std::strchr(units, *end | 0x20))
+	{
+		int shift = 10 * (std::strchr(units, *end++ | 0x20) - units + 1);
+		if (value > std::numeric_limits<unsigned long long>::max() >> shift)
+			return false;
+		value <<= shift;
+	}
+	if (*end || value < min || value > max)
+		return false;
+	out = value;
+	return true;
+}
+
+static bool	parseRate(const std::string &text, double &out)
+{
+	char *end = nullptr;
+	double value = std::strtod(text.c_str(), &end);
+	if (end == text.c_str() || *end || not (value > 0))
+		return false;
+	out = value;
+	return true;
+}
+
+static bool	parseBool(const std::string &text, bool &out)
+{
+	for (const char *yes : {"1", "yes", "on", "true"})
+		if (strcasecmp(text.c_str(), yes) == 0)
+			return out = true;
+	for (const char *no : {"0", "no", "off", "false"})
+		if (strcasecmp(text.c_str(), no) == 0)
+			return not (out = false);
+	return false;
+}
+
+static Setter	size(size_t Settings::*field, size_t min,
+	size_t max = std::numeric_limits<uint32_t>::max())
+{
+	return [=](Settings &settings, const std::string &text) {
+		return parseSize(text, settings.*field, min, max);
+	};
+}
+
+static Setter	text(std::string Settings::*field)
+{
+	return [=](Settings &settings, const std::string &text) {
+		settings.*field = text;
+		return true;
+	};
+}
+
+static Setter	rate(double AdmitLimits::*field)
+{
+	return [=](Settings &settings, const std::string &text) {
+		return parseRate(text, settings.admit.*field);
+	};
+}
+
+static const std::vector<Key>	&keys(void)
+{
+	static const std::vector<Key> keys = {
+		{"tls_port", text(&Settings::tlsPort)},
+		{"tls_cert", text(&Settings::tlsCert)},
+		{"tls_key", text(&Settings::tlsKey)},
+		{"log_file", text(&Settings::logFile)},
+		{"shards", size(&Settings::shards, 1, shardsMax)},
+		{"pin", [](Settings &settings, const std::string &text) {
+			return parseBool(text, settings.pin);
+		}},
+		{"log_level", [](Settings &settings, const std::string &text) {
+			return Log::parseLevel(text, settings.logLevel);
+		}},
+		{"backlog", size(&Settings::backlog, 1, 65535)},
+		{"epoll_events", size(&Settings::epollEvents, 1, epollEventsMax)},
+		{"busy_poll", [](Settings &settings, const std::string &text) {
+			size_t value = 0;
+			if (not parseSize(text, value, 0, 1000000))
+				return false;
+			settings.busyPoll = value;
+			return true;
+		}},
+		{"overload_lag", size(&Settings::overloadLag, 0, 60000)},
+		{"overload_queue", size(&Settings::overloadQueue, 0)},
+		{"busy_poll_socket", [](Settings &settings, const std::string &text) {
+			return parseBool(text, settings.busyPollSocket);
+		}},
+		{"accept_batch", size(&Settings::accepts, 1, 65536)},
+		{"recv_buffer", size(&Settings::recvBuffer, 512, 1 << 20)},
+		{"line_max", size(&Settings::lineMax, 512, 65536)},
+		{"recvq", size(&Settings::recvq, 1024)},
+		{"sendq_soft", size(&Settings::sendqSoft, 512)},
+		{"sendq_hard", size(&Settings::sendqHard, 512)},
+		{"sendq_grace", size(&Settings::sendqGrace, 1, 3600)},
+		{"admit_per_address", [](Settings &settings, const std::string &text) {
+			size_t value = 0;
+			if (not parseSize(text, value, 1, std::numeric_limits<uint32_t>::max()))
+				return false;
+			settings.admit.perAddress = value;
+			return true;
+		}},
+		{"admit_address_rate", rate(&AdmitLimits::addressRate)},
+		{"admit_address_burst", rate(&AdmitLimits::addressBurst)},
+		{"admit_global_rate", rate(&AdmitLimits::globalRate)},
+		{"admit_global_burst", rate(&AdmitLimits::globalBurst)},
+		{"fanout_threads", [](Settings &settings, const std::string &text) {
+			size_t value = 0;
+			if (strcasecmp(text.c_str(), "auto") == 0)
+				settings.fanoutThreads = -1;
+			else if (parseSize(text, value, 0, fanoutThreadsMax))
+				settings.fanoutThreads = value;
+			else
+				return false;
+			return true;
+		}},
+		{"fanout_chunk", size(&Settings::chunk, 1)},
+		{"nick_max", size(&Settings::nickMax, 1, rosterNickMax)},
+		{"channel_max", size(&Settings::channelMax, 1, 200)},
+		{"motd_file", text(&Settings::motdFile)},
+		{"memory_budget", size(&Settings::memory, 0, std::numeric_limits<size_t>::max())},
+	};
+	return keys;
+}
+
+static const Key	*findKey(const std::string &name)
+{
+	for (const Key &key : keys())
+		if (name == key.name)
+			return &key;
+	return nullptr;
+}
+
+static std::string	trim(const std::string &text)
+{
+	size_t start = text.find_first_not_of(" \t\r");
+	if (start == std::string::npos)
+		return "";
+	return text.substr(start, text.find_last_not_of(" \t\r") - start + 1);
+}
+
+/**
+ * Read every line of path into out, all problems are logged before giving up
+ */
+bool	Config::_read(const std::string &path, Settings &out)
+{
+	std::ifstream file(path);
+	if (not file)
+	{
+		Log::error("Config: cannot read ", path);
+		return false;
+	}
+	std::string line;
+	bool ok = true;
+	for (size_t number = 1; std::getline(file, line); ++number)
+	{
+		line = trim(line.substr(0, line.find('#')));
+		if (line.empty())
+			continue ;
+		size_t equal = line.find('=');
+		std::string name = trim(line.substr(0, equal));
+		std::string value = equal == std::string::npos ? "" : trim(line.substr(equal + 1));
+		const Key *key = findKey(name);
+		if (equal == std::string::npos || not key)
+		{
+			Log::error("Config: ", path, ":", number, ": unknown setting ", name);
+			ok = false;
+		}
+		else if (not key->set(out, value))
+		{
+			Log::error("Config: ", path, ":", number, ": bad value for ", name, ": ", value);
+			ok = false;
+		}
+	}
+	if (out.sendqSoft > out.sendqHard)
+	{
+		Log::error("Config: ", path, ": sendq_soft is above sendq_hard");
+		ok = false;
+	}
+	if (out.recvq <= out.lineMax)
+	{
+		Log::error("Config: ", path, ": recvq has to be above line_max");
+		ok = false;
+	}
+	return ok;
+}
+
+/**
+ * The environment variables that configured the server before there was a
+ * file win over it
+ */
+bool	Config::_environment(Settings &out)
+{
+	static const std::pair<const char *, const char *> names[] = {
+		{tlsPortEnv, "tls_port"}, {tlsCertEnv, "tls_cert"}, {tlsKeyEnv, "tls_key"},
+		{logLevelEnv, "log_level"}, {logFileEnv, "log_file"},
+		{shardsEnv, "shards"}, {shardPinEnv, "pin"},
+		{fanoutThreadsEnv, "fanout_threads"}, {fanoutChunkEnv, "fanout_chunk"},
+	};
+	bool ok = true;
+	for (const auto &[env, name] : names)
+	{
+		const char *value = getenv(env);
+		if (value && not findKey(name)->set(out, value))
+		{
+			Log::error("Config: bad value for ", env, ": ", value);
+			ok = false;
+		}
+	}
+	return ok;
+}
+
+bool	Config::load(void)
+{
+	Settings settings;
+	const char *path = getenv(configEnv);
+
+	_path = path ? path : configPath;
+	if ((path || std::ifstream(_path)) && not _read(_path, settings))
+		return false;
+	if (not _environment(settings))
+		return false;
+	_current = settings;
+	return true;
+}
+
+/* Keep the running value of a key that needs a restart */
+template <typename T>
+static bool	keep(T &next, const T &running)
+{
+	bool changed = next != running;
+	next = running;
+	return changed;
+}
+
+bool	Config::reload(void)
+{
+	Settings next;
+
+	if (not std::ifstream(_path) && not getenv(configEnv))
+		Log::info("Config: no ", _path, ", using the defaults");
+	else if (not _read(_path, next))
+	{
+		Log::warn("Config: reload of ", _path, " rejected, settings unchanged");
+		return false;
+	}
+	_environment(next);
+	bool restart = keep(next.tlsPort, _current.tlsPort) | keep(next.tlsCert, _current.tlsCert)
+		| keep(next.tlsKey, _current.tlsKey) | keep(next.logFile, _current.logFile)
+		| keep(next.shards, _current.shards) | keep(next.pin, _current.pin);
+	if (restart)
+		Log::warn("Config: TLS, log file and shard changes take effect after a restart");
+	_current = next;
+	++_reloads;
+	Log::info("Config: reloaded ", _path);
+	return true;
+}
+
+const Settings	&Config::current(void)
+{
+	return _current;
+}
+
+const std::string	&Config::path(void)
+{
+	return _path;
+}
+
+size_t	Config::reloads(void)
+{
+	return _reloads;
+}
@@ -0,0 +1,77 @@
+#include "Fanout.hpp"
+#include "Channel.hpp"
+#include "Client.hpp"
+#include <algorithm>
+#include <memory>
+
+/**
+ * @param command	PRIVMSG or NOTICE
+ * @param except	Link the message came from, it is not sent back there
+ */
+Fanout::Fanout(Client &from, const std::string &command,
+	const std::string &text, int except)
+	: _from(from),
+	_head(":" + from.getUser().getNick() + " " + command + " "),
+	_tail(" :" + text + "\r\n"),
+	_except(except),
+	_epoch(irc->nextEpoch()) {
+}
+
+void Fanout::_route(int link, const std::string &target) {
+	if (link == _except)
+		return ;
+	std::vector<std::string> &targets = _routes[link];
+	if (targets.empty() || targets.back() != target)
+		targets.push_back(target);
+}
+
+void Fanout::channel(const Channel &ch) {
+	for (int link : ch.routes())
+		_route(link, ch.getName());
+	// The sender is left out of its channels, but still gets a message to
+	// its own nick
+	ch.deliver(std::make_shared<const std::string>(_head + ch.getName() + _tail),
+		_from.getFd(), _epoch);
+}
+
+void Fanout::user(Client &to, const std::string &nick) {
+	if (to.isRemote())
+		_route(to.route(), nick);
+	else if (to.visit(_epoch))
+		to.queue(_head + nick + _tail);
+}
+
+/**
+ * Pass the message on to every link that has recipients behind it
+ */
+void Fanout::flush(void) {
+	for (auto &[link, targets] : _routes) {
+		std::string list;
+		for (const std::string &target : targets)
+			list += (list.empty() ? "" : ",") + target;
+		irc->getClient(link)->queue(_head + list + _tail);
+	}
+	_routes.clear();
+}
+
+/**
+ * Split a comma separated parameter like "#a,#b,nick"
+ * @param unique	Drop empty and repeated entries, keys of a JOIN keep
+ *					their position so they are split with unique off
+ */
+std::vector<std::string> splitList(const std::string &list, bool unique) {
+	std::vector<std::string> ret;
+	size_t start = 0;
+
+	while (start <= list.size()) {
+		size_t end = list.find(',', start);
+		if (end == std::string::npos)
+			end = list.size();
+		std::string item = list.substr(start, end - start);
+		if (not unique || (not item.empty()
+			&& std::find(ret.begin(), ret.end(), item) == ret.end()))
+			ret.push_back(std::move(item));
+		start = end + 1;
+	}
+	return ret;
+}
@@ -1,44 +1,124 @@
 #include "Handler.hpp"
+#include "Log.hpp"
+#include "Config.hpp"
+#include "Socket.hpp"
+#include <cerrno>
+#include <cstring>
 
 using namespace std;
 
+/*
+ * Read until the socket runs dry, as edge triggered epoll will not report
+ * what is left. The recvq cap bounds what a client can have buffered, lines
+ * are dispatched after every read so the cap only fills when a client sends
+ * faster than its commands run. After readBatch reads the client goes back
+ * to the end of the line and the rest is read on the next loop iteration.
+ */
 void Handler::clientWrite(int fd) {
-	ssize_t messageLen = 0;
-	vector<char> buf(BUFSIZ);
+	const Settings &settings = Config::current();
+	vector<char> buf(settings.recvBuffer);
 	Client* client = irc->getClient(fd);
 	RecvParser& parser = client->getParser();
 	std::queue<std::unique_ptr<Message>> &msg_queue = parser.getQueue();
 
-	messageLen = recv(fd, &buf[0], buf.size(), 0);
-	if (messageLen == -1)
-		throw runtime_error("Failure receiving message");
-	parser.feed(&buf[0], messageLen);
-	while (!msg_queue.empty())
-	{
-		const unique_ptr<Message> &msg = msg_queue.front();
-		if (not irc->getClient(fd)->getDispatch()->dispatch(msg, fd))
+	for (size_t reads = 0; not client->isClosing(); ++reads) {
+		if (reads == readBatch)
+			return irc->markReadable(fd);
+		size_t held = parser.pending().size() + parser.queued();
+		if (held >= settings.recvq) {
+			irc->metrics().recvqEvictions++;
+			return client->evict("RecvQ exceeded");
+		}
+		ssize_t messageLen = Socket::recv(fd, &buf[0], min(buf.size(), settings.recvq - held), 0);
+		if (messageLen == -1 && errno == EINTR)
+			continue ;
+		if (messageLen == -1 && (errno == EAGAIN || errno == EWOULDBLOCK))
 			return ;
-		msg_queue.pop();
+		if (messageLen == -1)
+			return client->evict("Read error");
+		if (messageLen == 0)
+			return client->evict(client->isLink() ? "Link closed"
+				: "Remote host closed the connection");
+		irc->hitters().bytes.add(client->talker(), messageLen);
+		size_t overlong = parser.overlong();
+		if (client->isTls()) {
+			string plain;
+			if (not client->decrypt(&buf[0], messageLen, plain))
+				return client->evict("TLS error");
+			parser.feed(plain.data(), plain.size());
+		} else
+			parser.feed(&buf[0], messageLen);
+		if (parser.overlong() != overlong) {
+			irc->metrics().overlongLines += parser.overlong() - overlong;
+			const string &nick = client->getUser().getNick();
+			client->queue("417 " + (nick.empty() ? "*" : nick)
+				+ " :Input line was too long\r\n");
+		}
+		client->account();
+		while (!msg_queue.empty())
+		{
+			const unique_ptr<Message> &msg = msg_queue.front();
+			irc->hitters().messages.add(client->talker());
+			if (not irc->getClient(fd)->getDispatch()->dispatch(msg, fd))
+				return ;
+			parser.pop();
+		}
+		client->account();
 	}
 }
 
-void Handler::clientDisconnect(int fd) {
-	cout << "Client with socket" << fd << " disconnected" << endl;
+void Handler::clientFlush(int fd) {
+	Client* client = irc->getClient(fd);
+
+	if (not client->flush())
+		client->evict("Write error");
 }
 
+/*
+ * Accept pending connections until the backlog is empty or accept_batch is
+ * reached, the listening socket is level triggered so the rest come with
+ * the next poll. Refused sockets get one ERROR line and are closed before
+ * a Client exists for them.
+ */
 void Handler::acceptClient(int socket) {
-	int fd;
-	struct sockaddr_in remote{};
-	socklen_t remoteLen{};
-
-	fd = accept4(socket, (struct sockaddr*) &remote, &remoteLen, O_NONBLOCK);
-
-	if (fd > 0) {
-		cout << "A client with fd nbr " << fd << " connected" << endl;
-		irc->addClient(fd);
-		irc->registerHandler(fd, EPOLLIN, clientWrite);
-		irc->registerHandler(fd, EPOLLRDHUP | EPOLLHUP, clientDisconnect);
-	} else {
-		throw runtime_error("Handler::acceptClient: Failed creating a new TCP connection to client");
+	for (size_t count = 0; count < Config::current().accepts; ++count) {
+		struct sockaddr_in remote{};
+		socklen_t remoteLen = sizeof(remote);
+
+		int fd = accept4(socket, (struct sockaddr*) &remote, &remoteLen, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd == -1) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return ;
+			if (errno == ECONNABORTED || errno == EINTR)
+				continue ;
+			throw runtime_error("Handler::acceptClient: Failed creating a new TCP connection to client");
+		}
+		Admission::Verdict verdict = irc->admission().admit(fd, remote.sin_addr.s_addr);
+		if (verdict != Admission::Admit) {
+			const string error = string("ERROR :") + Admission::reason(verdict) + "\r\n";
+			Socket::send(fd, error.data(), error.size(), MSG_DONTWAIT | MSG_NOSIGNAL);
+			close(fd);
+			Log::warn("Refused connection from ", inet_ntoa(remote.sin_addr), ": ",
+				Admission::reason(verdict));
+			continue ;
+		}
+		const char *address = inet_ntoa(remote.sin_addr);
+		Log::info("Client connected fd=", fd, " address=", address);
+		if (Config::current().busyPollSocket) {
+			int usec = Config::current().busyPoll;
+			// Raising it above net.core.busy_poll needs CAP_NET_ADMIN
+			if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) == -1)
+				Log::debug("SO_BUSY_POLL failed fd=", fd, ": ", strerror(errno));
+		}
+		registerClient(fd);
+		irc->getClient(fd)->setAddress(address);
+		if (socket == irc->getTlsFd())
+			irc->getClient(fd)->startTls();
 	}
 }
+
+void Handler::registerClient(int fd) {
+	irc->addClient(fd);
+	irc->registerHandler(fd, EPOLLIN, clientWrite);
+	irc->registerHandler(fd, EPOLLOUT, clientFlush);
+}
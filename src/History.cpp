@@ -0,0 +1,111 @@
+#include "History.hpp"
+#include "Memory.hpp"
+#include <chrono>
+
+std::unordered_set<History *> History::_all;
+size_t History::_total = 0;
+size_t History::_evicted = 0;
+
+History::History(void) {
+	_all.insert(this);
+}
+
+History::~History() {
+	while (not _entries.empty())
+		_popFront();
+	_all.erase(this);
+}
+
+size_t	History::_cost(const HistoryEntry &entry) {
+	return sizeof(entry) + entry.text.size();
+}
+
+void	History::_popFront(void) {
+	HistoryEntry &entry = _entries.front();
+	size_t cost = _cost(entry);
+	_bytes -= cost;
+	_total -= cost;
+	Memory::release(Memory::History, cost);
+	_entries.pop_front();
+}
+
+void	History::_trim(size_t bytes) {
+	while (not _entries.empty() && _bytes > bytes) {
+		_popFront();
+		++_evicted;
+	}
+}
+
+/**
+ * Append an event, evicting the oldest ones of this channel past its
+ * bounds and of every channel past the global budget.
+ * @param source nick!user@host, with or without the leading ':'
+ */
+void	History::add(HistoryEntry::Type type, const std::string &source,
+	const std::string &text) {
+	const std::string &name = source[0] == ':' ? source.substr(1) : source;
+	_entries.push_back({now(), Name(name), type, text});
+	size_t cost = _cost(_entries.back());
+	_bytes += cost;
+	_total += cost;
+	Memory::charge(Memory::History, cost);
+	if (_entries.size() > historyLines) {
+		_popFront();
+		++_evicted;
+	}
+	_trim(historyBytes);
+	if (_total > historyBudget)
+		for (History *history : _all)
+			history->_trim(history->_bytes / 4 * 3);
+}
+
+const std::deque<HistoryEntry>&	History::entries(void) const {
+	return _entries;
+}
+
+/**
+ * @return the event as the line that was sent, without a tag prefix or
+ * the trailing CRLF
+ */
+std::string	History::format(const HistoryEntry &entry, const std::string &channel) {
+	std::string line = ":" + entry.source.str();
+
+	switch (entry.type) {
+		case HistoryEntry::Privmsg:
+			return line + " PRIVMSG " + channel + " :" + entry.text;
+		case HistoryEntry::Join:
+			return line + " JOIN :" + channel;
+		case HistoryEntry::Part:
+			if (entry.text.empty())
+				return line + " PART " + channel;
+			return line + " PART " + channel + " :" + entry.text;
+		case HistoryEntry::Topic:
+			return line + " TOPIC " + channel + " :" + entry.text;
+	}
+	return line;
+}
+
+int64_t	History::now(void) {
+	using namespace std::chrono;
+	return duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+}
+
+/**
+ * Halve every channel's history to free memory
+ * @return false if there was nothing to trim
+ */
+bool	History::shrink(void) {
+	size_t before = _total;
+
+	for (History *history : _all)
+		history->_trim(history->_bytes / 2);
+	return _total < before;
+}
+
+size_t	History::total(void) {
+	return _total;
+}
+
+size_t	History::evicted(void) {
+	return _evicted;
+}
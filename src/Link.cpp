@@ -0,0 +1,571 @@
+#include "Link.hpp"
+#include "Log.hpp"
+#include "Fanout.hpp"
+#include <netdb.h>
+#include <cerrno>
+#include <cstring>
+
+/* SJOIN lines are split so they stay under the 512 byte line limit */
+constexpr size_t sjoinLineMax = 480;
+
+#define ME ":" + irc->getName()
+
+/**
+ * Open a non-blocking connection to another server, PASS and SERVER are
+ * queued right away and written once the connection is established.
+ * @param host	Address of the other server
+ * @param port	Its client port
+ */
+void	Link::connect(const std::string &host, const std::string &port)
+{
+	struct addrinfo hints{};
+	struct addrinfo *res = nullptr;
+	hints.ai_family = AF_INET;
+	hints.ai_socktype = SOCK_STREAM;
+	if (getaddrinfo(host.c_str(), port.c_str(), &hints, &res) != 0)
+		throw (std::runtime_error("Link::connect: Failed to resolve " + host));
+	int sock = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (sock == -1 || (::connect(sock, res->ai_addr, res->ai_addrlen) == -1
+		&& errno != EINPROGRESS))
+	{
+		freeaddrinfo(res);
+		if (sock != -1)
+			close(sock);
+		throw (std::runtime_error("Link::connect: Failed to connect to "
+			+ host + " " + port + ": " + strerror(errno)));
+	}
+	freeaddrinfo(res);
+	attach(sock, host);
+	Log::info("Connecting to server ", host, " ", port);
+}
+
+/**
+ * Start linking over a socket that is already connected to another server
+ * @param address	Shown as the peer address
+ */
+void	Link::attach(int fd, const std::string &address)
+{
+	Handler::registerClient(fd);
+	Client *client = irc->getClient(fd);
+	client->setAddress(address);
+	client->authenticate();
+	client->accessLinkPending() = true;
+	handshake(fd);
+}
+
+void	Link::handshake(int fd)
+{
+	irc->getClient(fd)->queue("PASS " + irc->getPassword() + "\r\nSERVER "
+		+ irc->getName() + " 1 :irc_hive\r\n");
+}
+
+/**
+ * Send everything this side of the link knows: servers, users, channels with
+ * their modes and members, and topics.
+ */
+void	Link::burst(int fd)
+{
+	Client *link = irc->getClient(fd);
+
+	for (auto &server : irc->getServers())
+		if (server.second != fd)
+			link->queue(ME + " SERVER " + server.first + " 2 :irc_hive\r\n");
+	for (auto &client : irc->getClients())
+	{
+		Client &other = *client.second;
+		if (other.isLink() || other.route() == fd || not other.accessRegistered()
+			|| other.getUser().getNick().empty())
+			continue;
+		link->queue(introduce(other) + "\r\n");
+	}
+	for (auto &channel : irc->getChannels())
+	{
+		for (auto &line : sjoin(channel.second, fd))
+			link->queue(line + "\r\n");
+		if (not channel.second.getTopic().empty())
+			link->queue(ME + " TOPIC " + channel.first + " :"
+				+ channel.second.getTopic() + "\r\n");
+	}
+}
+
+/**
+ * Tear down a link: every user behind it quits, the servers behind it are
+ * squit on the rest of the network.
+ */
+void	Link::unlink(int fd, const std::string &reason)
+{
+	std::vector<int> lost;
+	std::vector<std::string> servers;
+	std::string split = irc->getName() + " " + irc->getClient(fd)->getServer();
+
+	for (auto &client : irc->getClients())
+		if (client.second->route() == fd)
+			lost.push_back(client.first);
+	for (int id : lost)
+		USER(id).quit(id, split);
+	for (auto &server : irc->getServers())
+		if (server.second == fd)
+			servers.push_back(server.first);
+	for (auto &name : servers)
+	{
+		irc->removeServer(name);
+		irc->propagate(ME + " SQUIT " + name + " :" + reason, fd);
+	}
+	Log::info("Link to ", irc->getClient(fd)->getServer(), " closed: ", reason);
+	irc->removeClient(fd);
+}
+
+/**
+ * Pass a command a local user sent on to the other servers
+ */
+void	Link::relay(const Message &msg, int fd)
+{
+	Message relay = msg;
+	relay.prefix = NICK;
+	irc->propagate(format(relay));
+}
+
+/**
+ * Remove a user right away. A local user gets an ERROR line before the
+ * connection is closed, a remote user just quits here.
+ */
+void	Link::kill(Client &client, const std::string &reason)
+{
+	if (not client.isRemote())
+		client.queue("ERROR :Closing Link: " + client.getUser().getHost()
+			+ " (" + reason + ")\r\n");
+	client.getUser().quit(client._fd, reason);
+}
+
+/**
+ * Apply a mode string that another server already validated
+ * @param index	Position of the first mode parameter in msg.params
+ */
+void	Link::applyModes(Channel &ch, const Message &msg, size_t index)
+{
+	std::vector<ModeChange> changes;
+	bool plus = true;
+
+	for (char c : msg.params[index - 1])
+	{
+		if (c == '+' || c == '-')
+		{
+			plus = (c == '+');
+			continue ;
+		}
+		if (c < 'a' || c > 'z')
+			continue ;
+		ModeChange change{c, plus};
+		if (c == 'o' || (plus && (c == 'k' || c == 'l')))
+		{
+			if (index >= msg.params.size())
+				break ;
+			const std::string &param = msg.params[index++];
+			if (c == 'k')
+				change.key = param;
+			else if (c == 'l' && not Channel::parseLimit(param, change.limit))
+				continue ;
+			else if (c == 'o')
+			{
+				Client *member = irc->findNick(param);
+				if (not member)
+					continue ;
+				change.member = member->_fd;
+			}
+		}
+		changes.push_back(change);
+	}
+	ch.apply(changes);
+}
+
+/**
+ * Find the user a link message comes from. Messages about users that are not
+ * behind that link come from the wrong direction and are ignored.
+ */
+Client	*Link::origin(const Message &msg, int link)
+{
+	if (not msg.prefix)
+		return nullptr;
+	Client *client = irc->findNick(msg.prefix->substr(0, msg.prefix->find('!')));
+	if (not client || client->route() != link)
+		return nullptr;
+	return client;
+}
+
+/**
+ * Prefix to show local users for a link message, the full nick!user@host of
+ * the user or the name of the server that sent it.
+ */
+std::string	Link::prefix(const Message &msg, int link)
+{
+	if (Client *client = origin(msg, link))
+		return client->getUser().getPrefix();
+	if (msg.prefix)
+		return ":" + *msg.prefix;
+	return ":" + irc->getClient(link)->getServer();
+}
+
+std::string	Link::format(const Message &msg)
+{
+	std::string line;
+
+	if (msg.prefix)
+		line = ":" + *msg.prefix + " ";
+	line += msg.command;
+	for (size_t idx = 0; idx < msg.params.size(); ++idx)
+	{
+		const std::string &param = msg.params[idx];
+		if (idx + 1 == msg.params.size() && (param.empty() || param[0] == ':'
+			|| param.find(' ') != std::string::npos))
+			line += " :" + param;
+		else
+			line += " " + param;
+	}
+	return line;
+}
+
+std::string	Link::introduce(Client &client)
+{
+	const User &user = client.getUser();
+	const std::string &server = client.isRemote() ? client.getServer()
+		: irc->getName();
+
+	return "NICK " + user.getNick() + " 1 " + std::to_string(user.getSignon())
+		+ " " + user.getUser() + " " + user.getHost() + " " + server
+		+ " :" + user.getUser();
+}
+
+/**
+ * Mode string of a channel with the parameters for +k and +l
+ */
+static std::string	modeLine(const Channel &ch)
+{
+	std::string modes = ch.modes(), params;
+
+	if (modes.empty())
+		modes = "+";
+	for (char c : modes)
+	{
+		if (c == 'k')
+			params += " " + ch.getPassword();
+		else if (c == 'l')
+			params += " " + std::to_string(ch.getLimit());
+	}
+	return modes + params;
+}
+
+std::string	Link::join(Channel &ch, int fd)
+{
+	std::string member = ch.getOperators().contains(fd) ? "@" + NICK : NICK;
+
+	return ME + " SJOIN " + ch.getTime() + " " + ch.getName() + " "
+		+ modeLine(ch) + " :" + member;
+}
+
+/**
+ * SJOIN lines for the members of a channel that are not behind a link
+ * @param except	The link the lines are for
+ */
+std::vector<std::string>	Link::sjoin(const Channel &ch, int except)
+{
+	std::vector<std::string> ret;
+	const std::string head = ME + " SJOIN " + ch.getTime() + " " + ch.getName()
+		+ " " + modeLine(ch) + " :";
+	std::string line = head;
+
+	auto add = [&](int member, const std::string &status) {
+		Client *client = irc->getClient(member);
+		if (client->route() == except)
+			return ;
+		std::string nick = status + client->getUser().getNick();
+		if (line.size() + nick.size() + 1 > sjoinLineMax)
+		{
+			line.pop_back();
+			ret.push_back(line);
+			line = head;
+		}
+		line += nick + " ";
+	};
+	for (auto member : ch.getOperators())
+		add(member, "@");
+	for (auto member : ch.getUsers())
+		add(member, "");
+	if (line.size() > head.size())
+	{
+		line.pop_back();
+		ret.push_back(line);
+	}
+	return ret;
+}
+
+static void	sendResponse(std::string message, int fd)
+{
+	message.append("\r\n");
+	irc->getClient(fd)->queue(std::move(message));
+}
+
+/**
+ * SERVER <name> <hopcount> :<description>, sent instead of NICK and USER by
+ * a server that wants to link. The PASS before it must match our password.
+ */
+void	ServerCommand::execute(const Message &msg, int fd)
+{
+	Client *client = irc->getClient(fd);
+
+	if (msg.params.empty())
+		return sendResponse(E461, fd);
+	if (client->accessRegistered() || not USER(fd).getNick().empty())
+		return sendResponse(E462, fd);
+	if (irc->checkPassword())
+		return client->evict("Server links need a password");
+	if (not client->isAuthenticated())
+		return client->evict("Bad password");
+	if (irc->serverExists(PARAM))
+		return client->evict("Server " + PARAM + " already exists");
+	if (not client->accessLinkPending())
+		Link::handshake(fd);
+	client->makeLink(PARAM);
+	irc->addLink(fd);
+	irc->addServer(PARAM, fd);
+	irc->propagate(ME + " SERVER " + PARAM + " 2 :irc_hive", fd);
+	Link::burst(fd);
+	Log::info("Linked with server ", PARAM);
+}
+
+void	LinkServerCommand::execute(const Message &msg, int fd)
+{
+	if (msg.params.empty())
+		return ;
+	if (irc->serverExists(PARAM))
+		return irc->getClient(fd)->evict("Server " + PARAM + " already exists");
+	irc->addServer(PARAM, fd);
+	irc->propagate(Link::format(msg), fd);
+}
+
+void	LinkSquitCommand::execute(const Message &msg, int fd)
+{
+	if (msg.params.empty())
+		return ;
+	auto server = irc->getServers().find(PARAM);
+	if (server == irc->getServers().end() || server->second != fd)
+		return ;
+	std::vector<int> lost;
+	for (auto &client : irc->getClients())
+		if (client.second->route() == fd && client.second->getServer() == PARAM)
+			lost.push_back(client.first);
+	for (int id : lost)
+		USER(id).quit(id, irc->getClient(fd)->getServer() + " " + PARAM);
+	irc->removeServer(PARAM);
+	irc->propagate(Link::format(msg), fd);
+}
+
+/**
+ * NICK <nick> <hop> <signon> <user> <host> <server> :<real> introduces a user,
+ * :<old> NICK <new> changes a nick.
+ *
+ * On a collision the user who signed on first keeps the nick. Both servers
+ * see the same timestamps and drop the same user, if they are equal both go.
+ */
+void	LinkNickCommand::execute(const Message &msg, int fd)
+{
+	if (msg.params.size() >= 6)
+	{
+		time_t signon = std::stol(msg.params[2]);
+		if (Client *existing = irc->findNick(PARAM))
+		{
+			time_t ours = existing->getUser().getSignon();
+			if (signon > ours)
+				return ;
+			Link::kill(*existing, "Nick collision");
+			if (signon == ours)
+				return ;
+		}
+		Client &client = irc->addRemote(fd);
+		User &user = client.getUser();
+		client.setServer(msg.params[5]);
+		user.setNick(client._fd, PARAM);
+		user.setUser(msg.params[3]);
+		user.setHost(msg.params[4]);
+		user.setSignon(signon);
+		irc->propagate(Link::format(msg), fd);
+		return ;
+	}
+	Client *client = Link::origin(msg, fd);
+	if (not client || msg.params.empty())
+		return ;
+	Client *existing = irc->findNick(PARAM);
+	if (existing && existing != client)
+	{
+		irc->getClient(fd)->queue(ME + " KILL " + PARAM + " :Nick collision\r\n");
+		Link::kill(*client, "Nick collision");
+		Link::kill(*existing, "Nick collision");
+		return ;
+	}
+	client->getUser().setNick(client->_fd, PARAM);
+	irc->propagate(Link::format(msg), fd);
+}
+
+/**
+ * SJOIN <ts> <#channel> <modes> [mode params] :<[@]nick ...>
+ *
+ * Members are merged, the modes of the older channel win.
+ */
+void	LinkSjoinCommand::execute(const Message &msg, int fd)
+{
+	if (msg.params.size() < 4)
+		return ;
+	time_t created = std::stol(PARAM);
+	bool fresh = not irc->channelExists(PARAM1);
+	Channel &ch = irc->addChannel(PARAM1);
+	if (fresh || created < std::stol(ch.getTime()))
+	{
+		ch.setTime(created);
+		Message modes = msg;
+		modes.params.pop_back();
+		Link::applyModes(ch, modes, 3);
+	}
+	std::istringstream members(msg.params.back());
+	std::string token;
+	while (members >> token)
+	{
+		bool oper = token[0] == '@';
+		Client *member = irc->findNick(oper ? token.substr(1) : token);
+		if (not member || member->route() != fd ||
+			not ch.addMember(member->_fd, oper))
+			continue ;
+		ch.message(-1, member->getUser().getPrefix() + " JOIN :" + PARAM1);
+		ch.record(HistoryEntry::Join, member->getUser().getPrefix());
+		if (oper)
+			ch.message(-1, ME + " MODE " + PARAM1 + " +o "
+				+ member->getUser().getNick());
+	}
+	if (ch.isEmpty())
+		irc->removeChannel(PARAM1);
+	irc->propagate(Link::format(msg), fd);
+}
+
+void	LinkPartCommand::execute(const Message &msg, int fd)
+{
+	Client *client = Link::origin(msg, fd);
+	if (not client || msg.params.empty())
+		return ;
+	Channel *ch = client->getUser().getChannel(PARAM);
+	if (not ch)
+		return ;
+	std::string response = PARAM;
+	if (msg.params.size() > 1)
+		response.append(" :" + PARAM1);
+	ch->record(HistoryEntry::Part, client->getUser().getPrefix(),
+		msg.params.size() > 1 ? PARAM1 : "");
+	ch->removeUser(client->_fd, response, "PART");
+	irc->propagate(Link::format(msg), fd);
+}
+
+/**
+ * A channel message is delivered to the local members and passed on once to
+ * every other link with members, a private message goes to its target. The
+ * targets may be a comma separated list, see Fanout.
+ */
+void	LinkPrivmsgCommand::execute(const Message &msg, int fd)
+{
+	Client *client = Link::origin(msg, fd);
+	if (not client || msg.params.size() < 2)
+		return ;
+	Fanout out(*client, msg.command, PARAM1, fd);
+	for (const std::string &target : splitList(PARAM))
+	{
+		if (target[0] == '#')
+		{
+			Channel *ch = irc->findChannel(target);
+			if (not ch)
+				continue ;
+			out.channel(*ch);
+			if (msg.command == "PRIVMSG")
+				ch->record(HistoryEntry::Privmsg, client->getUser().getPrefix(), PARAM1);
+		}
+		else if (Client *target_client = irc->findNick(target))
+			out.user(*target_client, target);
+	}
+	out.flush();
+}
+
+void	LinkQuitCommand::execute(const Message &msg, int fd)
+{
+	Client *client = Link::origin(msg, fd);
+	if (not client)
+		return ;
+	client->getUser().quit(client->_fd, msg.params.empty() ? "" : PARAM);
+}
+
+void	LinkKillCommand::execute(const Message &msg, int fd)
+{
+	(void)fd;
+	if (msg.params.empty())
+		return ;
+	if (Client *target = irc->findNick(PARAM))
+		Link::kill(*target, msg.params.size() > 1 ? PARAM1 : "Killed");
+}
+
+void	LinkModeCommand::execute(const Message &msg, int fd)
+{
+	if (msg.params.size() < 2)
+		return ;
+	Channel *ch = irc->findChannel(PARAM);
+	if (not ch)
+		return ;
+	Link::applyModes(*ch, msg, 2);
+	Message local = msg;
+	local.prefix.reset();
+	ch->message(-1, Link::prefix(msg, fd) + " " + Link::format(local));
+	irc->propagate(Link::format(msg), fd);
+}
+
+void	LinkTopicCommand::execute(const Message &msg, int fd)
+{
+	if (msg.params.size() < 2)
+		return ;
+	Channel *ch = irc->findChannel(PARAM);
+	if (not ch)
+		return ;
+	ch->restoreTopic(PARAM1);
+	ch->record(HistoryEntry::Topic, Link::prefix(msg, fd), PARAM1);
+	ch->message(-1, Link::prefix(msg, fd) + " TOPIC " + PARAM + " :" + PARAM1);
+	irc->propagate(Link::format(msg), fd);
+}
+
+void	LinkKickCommand::execute(const Message &msg, int fd)
+{
+	Client *client = Link::origin(msg, fd);
+	if (not client || msg.params.size() < 2)
+		return ;
+	Channel *ch = irc->findChannel(PARAM);
+	Client *target = irc->findNick(PARAM1);
+	if (not ch || not target)
+		return ;
+	Message local = msg;
+	local.prefix.reset();
+	ch->message(-1, client->getUser().getPrefix() + " " + Link::format(local));
+	ch->kick(client->_fd, target->_fd);
+	irc->propagate(Link::format(msg), fd);
+}
+
+void	LinkInviteCommand::execute(const Message &msg, int fd)
+{
+	Client *client = Link::origin(msg, fd);
+	if (not client || msg.params.size() < 2)
+		return ;
+	Client *target = irc->findNick(PARAM);
+	if (not target)
+		return ;
+	if (target->isRemote())
+		return (void)target->queue(Link::format(msg) + "\r\n");
+	if (Channel *ch = irc->findChannel(PARAM1))
+		ch->invite(target->_fd);
+	target->queue(client->getUser().getPrefix() + " INVITE " + PARAM
+		+ " :" + PARAM1 + "\r\n");
+}
+
+void	LinkErrorCommand::execute(const Message &msg, int fd)
+{
+	irc->getClient(fd)->evict(msg.params.empty() ? "ERROR" : PARAM);
+}
@@ -0,0 +1,249 @@
+#include "Log.hpp"
+#include <chrono>
+#include <ctime>
+#include <cstdio>
+#include <strings.h>
+#include <thread>
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Call sites tracked by the rate limiter, colliding ones share a budget */
+constexpr size_t logRateSlots = 256;
+constexpr size_t logBatchMax = 64 * 1024;
+
+std::atomic<uint8_t> Log::_level{Log::Info};
+
+namespace {
+	struct	Rate
+	{
+		std::atomic<const char *>	key{nullptr};
+		std::atomic<int64_t>		window{0};
+		std::atomic<uint32_t>		count{0};
+		std::atomic<uint32_t>		skipped{0};
+	};
+
+	struct	Ring
+	{
+		LogSlot				slots[logSlots];
+		std::atomic<size_t>	head{0};
+		size_t				tail = 0;
+
+		Ring(void)
+		{
+			for (size_t idx = 0; idx < logSlots; ++idx)
+				slots[idx].seq.store(idx, std::memory_order_relaxed);
+		}
+	};
+
+	Ring				ring;
+	Rate				rates[logRateSlots];
+	std::thread			writer;
+	std::atomic<bool>	running{false};
+	std::atomic<bool>	sleeping{false};
+	std::atomic<size_t>	dropped{0};
+	std::atomic<size_t>	suppressed{0};
+	int					out = STDERR_FILENO;
+
+	const char	*names[] = {"DEBUG", "INFO", "WARN", "ERROR"};
+
+	/* Write out every committed line, in as few write() calls as fit */
+	void	drain(void)
+	{
+		static char batch[logBatchMax];
+		static int64_t second = -1;
+		static char stamp[24];
+		size_t used = 0;
+
+		auto flush = [&]() {
+			for (size_t done = 0; done < used; )
+			{
+				ssize_t len = write(out, batch + done, used - done);
+				if (len <= 0)
+					break ;
+				done += len;
+			}
+			used = 0;
+		};
+		for (;;)
+		{
+			LogSlot &slot = ring.slots[ring.tail % logSlots];
+			if (slot.seq.load(std::memory_order_acquire) != ring.tail + 1)
+				break ;
+			if (slot.time / 1000 != second)
+			{
+				second = slot.time / 1000;
+				std::time_t secs = second;
+				struct tm tm{};
+				gmtime_r(&secs, &tm);
+				std::strftime(stamp, sizeof(stamp), "%Y-%m-%dT%H:%M:%S", &tm);
+			}
+			if (used + logLineMax + 64 > sizeof(batch))
+				flush();
+			used += std::snprintf(batch + used, sizeof(batch) - used, "%s.%03dZ %-5s %.*s\n",
+				stamp, int(slot.time % 1000), names[slot.level], int(slot.len), slot.line);
+			slot.seq.store(ring.tail + logSlots, std::memory_order_release);
+			++ring.tail;
+		}
+		flush();
+	}
+
+	void	run(void)
+	{
+		while (running.load())
+		{
+			sleeping.store(true);
+			LogSlot &slot = ring.slots[ring.tail % logSlots];
+			if (slot.seq.load(std::memory_order_acquire) != ring.tail + 1 && running.load())
+				sleeping.wait(true);
+			sleeping.store(false);
+			drain();
+		}
+		drain();
+	}
+}
+
+/**
+ * Start the writer thread
+ * @param path file to append to, stderr if empty
+ */
+void	Log::start(Level level, const std::string &path)
+{
+	_level = level;
+	if (not path.empty())
+	{
+		int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0640);
+		if (fd == -1)
+			Log::error("Log: cannot open ", path, ", logging to stderr");
+		else
+			out = fd;
+	}
+	if (running.exchange(true))
+		return ;
+	writer = std::thread(run);
+}
+
+/**
+ * Write out what is still queued and join the writer thread. Must run
+ * before exit, a joinable std::thread terminates the process.
+ */
+void	Log::stop(void)
+{
+	if (not running.exchange(false))
+		return ;
+	sleeping.store(false);
+	sleeping.notify_one();
+	writer.join();
+	if (out != STDERR_FILENO)
+		close(out);
+	out = STDERR_FILENO;
+}
+
+Log::Level	Log::level(void)
+{
+	return static_cast<Level>(_level.load());
+}
+
+void	Log::setLevel(Level level)
+{
+	_level = level;
+}
+
+bool	Log::parseLevel(const std::string &name, Level &level)
+{
+	for (uint8_t idx = Debug; idx <= Error; ++idx)
+		if (strcasecmp(name.c_str(), names[idx]) == 0)
+		{
+			level = static_cast<Level>(idx);
+			return true;
+		}
+	return false;
+}
+
+const char	*Log::levelName(Level level)
+{
+	return names[level];
+}
+
+size_t	Log::dropped(void)
+{
+	return ::dropped.load();
+}
+
+size_t	Log::suppressed(void)
+{
+	return ::suppressed.load();
+}
+
+/**
+ * Claim the next free slot of the ring
+ * @return nullptr when the ring is full, the line is dropped
+ */
+LogSlot	*Log::_reserve(void)
+{
+	size_t pos = ring.head.load(std::memory_order_relaxed);
+
+	for (;;)
+	{
+		LogSlot &slot = ring.slots[pos % logSlots];
+		size_t seq = slot.seq.load(std::memory_order_acquire);
+		if (seq == pos)
+		{
+			if (ring.head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+			{
+				slot.ticket = pos;
+				slot.len = 0;
+				return &slot;
+			}
+		}
+		else if (static_cast<intptr_t>(seq - pos) < 0)
+		{
+			++::dropped;
+			return nullptr;
+		}
+		else
+			pos = ring.head.load(std::memory_order_relaxed);
+	}
+}
+
+void	Log::_commit(LogSlot *slot, Level level)
+{
+	using namespace std::chrono;
+	slot->time = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+	slot->level = level;
+	slot->seq.store(slot->ticket + 1, std::memory_order_release);
+	if (not running.load())
+		return drain();
+	if (sleeping.exchange(false))
+		sleeping.notify_one();
+}
+
+/**
+ * Count a line against the budget of its call site for the current second
+ * @return lines of this call site suppressed in an earlier second
+ */
+uint32_t	Log::_allow(const char *what, bool &allowed)
+{
+	Rate &rate = rates[(reinterpret_cast<uintptr_t>(what) >> 3) % logRateSlots];
+	int64_t now = std::time(nullptr);
+	uint32_t skipped = 0;
+
+	if (rate.key.load() != what)
+	{
+		rate.key.store(what);
+		rate.window.store(now);
+		rate.count.store(0);
+		rate.skipped.store(0);
+	}
+	else if (rate.window.exchange(now) != now)
+	{
+		rate.count.store(0);
+		skipped = rate.skipped.exchange(0);
+	}
+	allowed = rate.count.fetch_add(1) < logRateBurst;
+	if (not allowed)
+	{
+		rate.skipped.fetch_add(1);
+		++::suppressed;
+	}
+	return skipped;
+}
@@ -0,0 +1,63 @@
+#include "Memory.hpp"
+
+std::atomic<size_t>	Memory::_used[Memory::Kinds] = {};
+size_t	Memory::_budget = memoryBudget;
+
+void	Memory::charge(Kind kind, size_t bytes)
+{
+	_used[kind].fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void	Memory::release(Kind kind, size_t bytes)
+{
+	_used[kind].fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+size_t	Memory::used(Kind kind)
+{
+	return _used[kind].load(std::memory_order_relaxed);
+}
+
+size_t	Memory::total(void)
+{
+	size_t sum = 0;
+
+	for (const std::atomic<size_t> &used : _used)
+		sum += used.load(std::memory_order_relaxed);
+	return sum;
+}
+
+const char	*Memory::name(Kind kind)
+{
+	static const char *names[Kinds] = {
+		"clients", "recvq", "sendq", "messages", "members", "history", "names"
+	};
+	return names[kind];
+}
+
+void	Memory::setBudget(size_t bytes)
+{
+	_budget = bytes;
+}
+
+size_t	Memory::budget(void)
+{
+	return _budget;
+}
+
+/**
+ * @return the furthest shedding step the current total has reached
+ */
+Memory::Pressure	Memory::pressure(void)
+{
+	if (_budget == 0)
+		return Normal;
+	size_t percent = total() * 100 / _budget;
+	if (percent >= memoryEvictAt)
+		return Evict;
+	if (percent >= memoryRefuseAt)
+		return Refuse;
+	if (percent >= memoryTrimAt)
+		return Trim;
+	return Normal;
+}
@@ -0,0 +1,148 @@
+#include "Name.hpp"
+#include "Memory.hpp"
+#include <algorithm>
+#include <cctype>
+
+std::unordered_map<std::string_view, Name::Entry *>	Name::_table;
+
+/* Charged for every interned string on top of its text: the entry and its
+ * node in the table */
+constexpr static const size_t nameOverhead = 96;
+
+static size_t	cost(const std::string &text)
+{
+	return nameOverhead + text.capacity();
+}
+
+std::string	Name::lowercase(std::string_view text)
+{
+	std::string lower(text);
+
+	std::transform(lower.begin(), lower.end(), lower.begin(),
+		[](unsigned char c) { return std::tolower(c); });
+	return lower;
+}
+
+/**
+ * Find or create the entry for text, with its lower-case entry
+ */
+Name::Entry	*Name::_acquire(std::string_view text)
+{
+	if (auto it = _table.find(text); it != _table.end())
+	{
+		++it->second->refs;
+		return it->second;
+	}
+	Entry *entry = new Entry{std::string(text), 0, 1, nullptr};
+	entry->hash = std::hash<std::string_view>()(entry->text);
+	_table.emplace(entry->text, entry);
+	Memory::charge(Memory::Names, cost(entry->text));
+
+	std::string lower = lowercase(text);
+	entry->folded = lower == text ? entry : _acquire(lower);
+	return entry;
+}
+
+void	Name::_release(Entry *entry)
+{
+	if (not entry || --entry->refs)
+		return ;
+	_table.erase(entry->text);
+	Memory::release(Memory::Names, cost(entry->text));
+	if (entry->folded != entry)
+		_release(entry->folded);
+	delete entry;
+}
+
+Name::Name(std::string_view text) : _entry(text.empty() ? nullptr : _acquire(text))
+{
+}
+
+Name::Name(const Name &other) : _entry(other._entry)
+{
+	if (_entry)
+		++_entry->refs;
+}
+
+Name::Name(Name &&other) noexcept : _entry(other._entry)
+{
+	other._entry = nullptr;
+}
+
+Name	&Name::operator=(const Name &other)
+{
+	if (other._entry)
+		++other._entry->refs;
+	_release(_entry);
+	_entry = other._entry;
+	return *this;
+}
+
+Name	&Name::operator=(Name &&other) noexcept
+{
+	if (this != &other)
+	{
+		_release(_entry);
+		_entry = other._entry;
+		other._entry = nullptr;
+	}
+	return *this;
+}
+
+Name::~Name()
+{
+	_release(_entry);
+}
+
+const std::string	&Name::str(void) const
+{
+	static const std::string empty;
+
+	return _entry ? _entry->text : empty;
+}
+
+bool	Name::empty(void) const
+{
+	return _entry == nullptr;
+}
+
+size_t	Name::hash(void) const
+{
+	return _entry ? _entry->hash : 0;
+}
+
+Name	Name::fold(void) const
+{
+	Name folded;
+
+	if (_entry)
+	{
+		folded._entry = _entry->folded;
+		++folded._entry->refs;
+	}
+	return folded;
+}
+
+bool	Name::same(const Name &other) const
+{
+	if (not _entry || not other._entry)
+		return _entry == other._entry;
+	return _entry->folded == other._entry->folded;
+}
+
+Name	Name::lookup(std::string_view text)
+{
+	Name name;
+
+	if (auto it = _table.find(text); it != _table.end())
+	{
+		name._entry = it->second;
+		++name._entry->refs;
+	}
+	return name;
+}
+
+size_t	Name::count(void)
+{
+	return _table.size();
+}
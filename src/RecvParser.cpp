@@ -1,4 +1,8 @@
 #include "RecvParser.hpp"
+#include "Log.hpp"
+#include <algorithm>
+
+size_t	RecvParser::_lineMax = 512;
 
 RecvParser::RecvParser(std::queue<std::unique_ptr<Message>> &msg_queue)
 	: _output(msg_queue){}
@@ -9,72 +13,130 @@ std::queue<std::unique_ptr<Message>> &RecvParser::getQueue(void)
 }
 
 /**
- *	Feed the recv() buffer into std::string buffer
+ *	Split the recv() buffer into lines as it arrives. \r, \n and \r\n all end
+ *	a line. Only the unfinished line is kept, and once it grows past the
+ *	line limit the rest of it is skipped up to the next line ending without
+ *	being stored.
  *	@param	read_buf	The buffer to read
  *	@param	len			Length of the buffer
  */
 void	RecvParser::feed(const char *read_buf, size_t len)
 {
-	_buffer.append(read_buf, len);
-	_normalizeNewLines();
-	_parseBuffer();
-}
+	const char	*end = read_buf + len;
 
-/**
- *	Make all newlines conform to IRC protocol to make evals take less time
- */
-void	RecvParser::_normalizeNewLines(void)
-{
-	std::string normalized;
-	normalized.reserve(_buffer.size());
-	for (size_t i = 0; i < _buffer.size(); ++i)
+	while (read_buf < end)
 	{
-		if (_buffer[i] == '\r')
+		const char	*eol = std::find_if(read_buf, end,
+			[](char c) { return c == '\r' || c == '\n'; });
+		size_t		chunk = eol - read_buf;
+
+		if (_discarding)
+			_discarded += chunk;
+		else if (_buffer.size() + chunk > _lineMax)
 		{
-			if (i + 1 < _buffer.size() && _buffer[i + 1] == '\n')
-			{
-				normalized += "\r\n";
-				++i;
-			}
-			else
-				normalized += "\r\n";
+			_discarded += _buffer.size() + chunk;
+			_buffer.clear();
+			_discarding = true;
+			++_overlong;
 		}
-		else if (_buffer[i] == '\n')
-			normalized += "\r\n";
 		else
-			normalized += _buffer[i];
+			_buffer.append(read_buf, chunk);
+		if (eol == end)
+			break ;
+		if (not _discarding && not _buffer.empty())
+			_parseLine(_buffer);
+		_buffer.clear();
+		_discarding = false;
+		read_buf = eol + 1;
 	}
-	_buffer = std::move(normalized);
 }
 
 /**
- *	Parse the internal buffer into the output queue.
- *	Newlines are \r\n as per IRC protocol.
+ *	The start of a line that has not been terminated yet
+ */
+const std::string	&RecvParser::pending(void) const
+{
+	return _buffer;
+}
+
+/**
+ *	Put back a partial line taken from pending(), without parsing it
+ */
+void	RecvParser::restore(const std::string &data)
+{
+	_buffer.append(data);
+}
+
+/**
+ *	Longest line accepted without the line ending, 512 unless the server
+ *	configures more
  */
-void	RecvParser::_parseBuffer(void)
+void	RecvParser::setLineMax(size_t bytes)
 {
-	size_t pos;
-	while ((pos = _buffer.find("\r\n")) != std::string::npos)
+	_lineMax = bytes;
+}
+
+/**
+ *	Take the front message off the queue
+ */
+void	RecvParser::pop(void)
+{
+	_queued -= footprint(*_output.front());
+	_output.pop();
+}
+
+/**
+ *	Bytes held by the queued messages that went through pop()
+ */
+size_t	RecvParser::queued(void) const
+{
+	return _queued;
+}
+
+/**
+ *	Lines dropped for being over the limit, and the bytes skipped with them
+ */
+size_t	RecvParser::overlong(void) const
+{
+	return _overlong;
+}
+
+size_t	RecvParser::discarded(void) const
+{
+	return _discarded;
+}
+
+size_t	RecvParser::footprint(const Message &msg)
+{
+	size_t bytes = sizeof(msg) + msg.command.capacity()
+		+ msg.params.capacity() * sizeof(std::string);
+
+	if (msg.prefix)
+		bytes += msg.prefix->capacity();
+	for (const std::string &param : msg.params)
+		bytes += param.capacity();
+	return bytes;
+}
+
+/**
+ *	Parse one line into the output queue
+ */
+void	RecvParser::_parseLine(const std::string &line)
+{
+	try
 	{
-		std::string line = _buffer.substr(0, pos);
-		_buffer.erase(0, pos + 2);
-		try
-		{
-			Message command = _parseMessage(line);
-			_output.push(std::make_unique<Message>(std::move(command)));
-		}
-		catch (std::exception &e)
-		{
-			std::cerr << "Recv parsing error: " << e.what() << std::endl;
-		}
+		Message command = _parseMessage(line);
+		_queued += footprint(command);
+		_output.push(std::make_unique<Message>(std::move(command)));
+	}
+	catch (std::exception &e)
+	{
+		Log::debug("Recv parsing error: ", e.what());
 	}
 }
 
 Message	RecvParser::_parseMessage(const std::string &msg)
 {
-	if (msg.size() > 512)
-		throw (std::runtime_error("Line is over 512 bytes"));
-
 	Message ret;
 
 	std::string line = msg;
@@ -0,0 +1,150 @@
+#include "Roster.hpp"
+#include "User.hpp"
+#include <algorithm>
+
+/* Bytes of a 353 line that are not the requester, channel or names */
+constexpr size_t namesOverhead = sizeof("353  @  :\r\n") - 1;
+
+Roster::Roster(const std::string &channel)
+	: _channel(channel),
+	_budget(512 - namesOverhead - rosterNickMax - std::min<size_t>(channel.size(), 200)) {
+}
+
+void	Roster::_render(Entry &entry, const User &user, bool oper) const {
+	entry.name = (oper ? "@" : "") + user.getNick();
+	entry.who = _channel + " " + user.getUser() + " " + user.getHost()
+		+ " localhost " + user.getNick() + (oper ? " H@" : " H")
+		+ " :0 " + user.getUser();
+}
+
+/**
+ * Append a member to the last chunk, or start a new one when its names
+ * would not fit on one line
+ */
+void	Roster::_place(int fd, Entry &entry) {
+	size_t size = entry.name.size() + 1;
+
+	if (_chunks.empty() || _chunks.back().bytes + size > _budget)
+		_chunks.emplace_back();
+	Chunk &chunk = _chunks.back();
+	chunk.members.push_back(fd);
+	chunk.bytes += size;
+	if (not chunk.dirty) {
+		if (not chunk.names.empty())
+			chunk.names += ' ';
+		chunk.names += entry.name;
+	}
+	entry.chunk = _chunks.size() - 1;
+	_bytes += size;
+}
+
+void	Roster::_unplace(int fd, size_t index, size_t size) {
+	Chunk &chunk = _chunks[index];
+
+	chunk.members.erase(std::find(chunk.members.begin(), chunk.members.end(), fd));
+	chunk.bytes -= size;
+	chunk.dirty = true;
+	_bytes -= size;
+}
+
+/* Pack every member into as few chunks as possible, keeping their order */
+void	Roster::_repack(void) {
+	std::vector<Chunk> chunks;
+
+	chunks.swap(_chunks);
+	_bytes = 0;
+	for (const Chunk &chunk : chunks)
+		for (int fd : chunk.members)
+			_place(fd, _entries.at(fd));
+}
+
+/* Render the names of chunks that lost or changed a member */
+void	Roster::_rebuild(void) const {
+	for (Chunk &chunk : _chunks) {
+		if (not chunk.dirty)
+			continue ;
+		chunk.names.clear();
+		chunk.names.reserve(chunk.bytes);
+		for (int fd : chunk.members) {
+			if (not chunk.names.empty())
+				chunk.names += ' ';
+			chunk.names += _entries.at(fd).name;
+		}
+		chunk.dirty = false;
+	}
+}
+
+void	Roster::add(int fd, const User &user, bool oper) {
+	if (_entries.contains(fd))
+		return update(fd, user, oper);
+	Entry &entry = _entries[fd];
+	_render(entry, user, oper);
+	_place(fd, entry);
+}
+
+void	Roster::remove(int fd) {
+	auto it = _entries.find(fd);
+	if (it == _entries.end())
+		return ;
+	_unplace(fd, it->second.chunk, it->second.name.size() + 1);
+	_entries.erase(it);
+	while (not _chunks.empty() && _chunks.back().members.empty())
+		_chunks.pop_back();
+	if (_chunks.size() > 2 * (_bytes / _budget + 1))
+		_repack();
+}
+
+/**
+ * Re-render a member after a nick or op change, in place when the new name
+ * still fits its chunk
+ */
+void	Roster::update(int fd, const User &user, bool oper) {
+	auto it = _entries.find(fd);
+	if (it == _entries.end())
+		return add(fd, user, oper);
+	Entry &entry = it->second;
+	Chunk &chunk = _chunks[entry.chunk];
+	size_t before = entry.name.size();
+	_render(entry, user, oper);
+	if (chunk.bytes - before + entry.name.size() <= _budget) {
+		chunk.bytes = chunk.bytes - before + entry.name.size();
+		_bytes = _bytes - before + entry.name.size();
+		chunk.dirty = true;
+		return ;
+	}
+	_unplace(fd, entry.chunk, before + 1);
+	_place(fd, entry);
+}
+
+/**
+ * @return the 353 lines for nick, each within 512 bytes
+ */
+std::string	Roster::names(const std::string &nick) const {
+	std::string out;
+
+	_rebuild();
+	for (const Chunk &chunk : _chunks) {
+		if (chunk.members.empty())
+			continue ;
+		out += "353 " + nick + " @ " + _channel + " :";
+		out += chunk.names;
+		out += "\r\n";
+	}
+	return out;
+}
+
+/**
+ * @return one 352 line for nick per member
+ */
+std::string	Roster::who(const std::string &nick) const {
+	std::string out;
+	const std::string head = "352 " + nick + " ";
+
+	for (const Chunk &chunk : _chunks)
+		for (int fd : chunk.members) {
+			out += head;
+			out += _entries.at(fd).who;
+			out += "\r\n";
+		}
+	return out;
+}
@@ -1,56 +1,107 @@
 #include "Server.hpp"
+#include "Link.hpp"
+#include "Log.hpp"
+#include <algorithm>
+#include <chrono>
+#include <dirent.h>
+#include <sys/stat.h>
 
-Server::Server(std::string port, std::string passwd)
-    : _startTime(time(nullptr)), _fd(epoll_create1(0)),
-      _sock(socket(AF_INET, SOCK_STREAM, 0)), _checker(0),
-      _port(stoi(port, &_checker)), _password(passwd) {
+Server::Server(std::string port, std::string passwd, int sock)
+    : _startTime(time(nullptr)), _fd(epoll_create1(EPOLL_CLOEXEC)),
+      _sock(sock == -1 ? socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0) : sock),
+      _checker(0),
+      _port(stoi(port, &_checker)), _max_events(Config::current().epollEvents),
+      _password(passwd),
+      _name("hive-" + std::to_string(_port) + ".localhost") {
   if (_fd == -1)
     throw std::runtime_error(
         "Server::Server: ERROR - Failed to create epoll file");
   else if (port[_checker])
     throw std::runtime_error("Server::Server: ERROR - Bad port number " + port);
+  if (sock == -1)
+    _listen(port);
+  fcntl(_sock, F_SETFL, fcntl(_sock, F_GETFL) | O_NONBLOCK);
+
+  struct epoll_event ev{};
+  ev.data.fd = _sock;
+  ev.events = EPOLLIN;
+  epoll_ctl(this->_fd, EPOLL_CTL_ADD, _sock, &ev);
+  _events.resize(_max_events);
+}
+
+static void bindAndListen(int sock, int port, const std::string &name) {
+  int backlog = Config::current().backlog;
   auto optval = 1;
-  setsockopt(_sock, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval));
+  setsockopt(sock, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(optval));
   struct sockaddr_in sa_bindy{};
   sa_bindy.sin_family = AF_INET;
-  sa_bindy.sin_port = htons(_port);
+  sa_bindy.sin_port = htons(port);
   sa_bindy.sin_addr.s_addr = htonl(INADDR_ANY);
 
-  if (bind(_sock, (struct sockaddr *)&sa_bindy, sizeof(sa_bindy))) {
-    close(_fd);
-    close(_sock);
+  if (bind(sock, (struct sockaddr *)&sa_bindy, sizeof(sa_bindy)))
     throw std::runtime_error("Server::Server: ERROR - Binding failed to " +
-                             port);
-  }
+                             name);
 
-  if (listen(_sock, 10)) {
+  if (listen(sock, backlog))
+    throw std::runtime_error("Server::Server: ERROR - Failed listen on port " +
+                             name);
+}
+
+void Server::_listen(const std::string &port) {
+  try {
+    bindAndListen(_sock, _port, port);
+  } catch (std::runtime_error &) {
     close(_fd);
     close(_sock);
-    throw std::runtime_error("Server::Server: ERROR - Failed listen on port " +
-                             port);
+    throw;
   }
+}
 
+void Server::listenTls(const std::string &port) {
+  size_t end = 0;
+  int number = stoi(port, &end);
+  if (port[end])
+    throw std::runtime_error("Server::listenTls: ERROR - Bad port number " + port);
+  int sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+  try {
+    bindAndListen(sock, number, port);
+  } catch (std::runtime_error &) {
+    close(sock);
+    throw;
+  }
   struct epoll_event ev{};
-  ev.data.fd = _sock;
+  ev.data.fd = sock;
   ev.events = EPOLLIN;
-  epoll_ctl(this->_fd, EPOLL_CTL_ADD, _sock, &ev);
-  _events.resize(_max_events);
+  epoll_ctl(_fd, EPOLL_CTL_ADD, sock, &ev);
+  _tlsSock = sock;
 }
 
 Server::~Server() {
+  _closeRemoved();
   close(_fd);
   close(_sock);
+  if (_tlsSock != -1)
+    close(_tlsSock);
 }
 
 bool Server::checkPassword(std::string password) const {
   return _password == password;
 }
 
+const std::string &Server::getPassword(void) const { return _password; }
+
 int Server::getServerFd() const { return _fd; }
 
+int Server::getListenFd() const { return _sock; }
+
+int Server::getTlsFd() const { return _tlsSock; }
+
+void Server::setStartTime(std::time_t start) { _startTime = start; }
+
+std::time_t Server::getStartTime(void) const { return _startTime; }
+
 Channel &Server::addChannel(std::string name) {
-  _channels.try_emplace(name, name);
-  return _channels.at(name);
+  return _channels.try_emplace(name, name).first->second;
 }
 
 void Server::removeChannel(std::string name) { _channels.erase(name); }
@@ -70,61 +121,112 @@ void Server::addClient(int fd) {
   _clients.try_emplace(fd, std::make_shared<Client>(fd));
 }
 
+/*
+ * The client is gone from every table right away, but the object lives and
+ * the socket stays open until the end of the poll iteration. The kernel
+ * cannot hand the fd to a new connection while events of the old one may
+ * still be in the batch, and handlers that are still running keep a valid
+ * object.
+ */
 void Server::removeClient(const int fd) {
-  if (not _clients.empty()) {
-    _clients.erase(fd);
+  if (auto it = _clients.find(fd); it != _clients.end()) {
+    // User::quit has left them already, anyone else must not leave the fd
+    // behind on a channel for the next connection to inherit
+    std::vector<Channel *> channels = it->second->getUser().getChannels();
+    for (Channel *channel : channels)
+      channel->leave(fd);
+    renameNick(fd, it->second->getUser().nickName(), Name());
+    it->second->flush();
+    _removed.push_back(std::move(it->second));
+    _clients.erase(it);
+  }
+  _pending.erase(fd);
+  _readable.erase(fd);
+  _links.erase(fd);
+}
+
+void Server::countSockets(size_t &open, size_t &leaked) const {
+  open = leaked = 0;
+  DIR *dir = opendir("/proc/self/fd");
+  if (not dir)
+    return;
+  while (struct dirent *entry = readdir(dir)) {
+    char *end = nullptr;
+    long fd = strtol(entry->d_name, &end, 10);
+    struct stat st{};
+    if (entry->d_name[0] == '.' || *end || fstat(fd, &st) || not S_ISSOCK(st.st_mode))
+      continue;
+    ++open;
+    if (fd == _sock || fd == _tlsSock || _clients.count(fd))
+      continue;
+    if (std::none_of(_removed.begin(), _removed.end(),
+                     [fd](auto &client) { return client->_fd == fd; }))
+      ++leaked;
   }
-  close(fd);
+  closedir(dir);
+}
+
+/*
+ * @brief Close the sockets of the clients removed during this iteration
+ */
+void Server::_closeRemoved(void) {
+  for (auto &client : _removed) {
+    if (client->_fd >= remoteIdBase)
+      continue;
+    _admission.release(client->_fd);
+    close(client->_fd);
+    _metrics.closed++;
+  }
+  _removed.clear();
 }
 
 void Server::_reloadHandler(Client &client) const {
-  uint32_t event = 0;
   struct epoll_event ev{};
   ev.data.fd = client._fd;
-  bool firstEvent = true;
+  // poll() evicts on a hang-up, whatever handlers the client has
+  ev.events = EPOLLET | EPOLLRDHUP;
 
   for (uint32_t evt : eventTypes) {
-    if (client.handler(evt)) {
-      event = evt;
-      firstEvent = false;
-    } else {
-      event |= evt;
-    }
-
-    if (firstEvent)
-      event = EPOLLET;
-    else
-      event |= EPOLLET;
-
-    ev.events = event;
+    if (client.handler(evt))
+      ev.events |= evt;
+  }
 
-    if (client._initialized) {
-      epoll_ctl(this->_fd, EPOLL_CTL_MOD, client._fd, &ev);
-    } else {
-      epoll_ctl(this->_fd, EPOLL_CTL_ADD, client._fd, &ev);
-      client._initialized = true;
-    }
+  if (client._initialized) {
+    epoll_ctl(this->_fd, EPOLL_CTL_MOD, client._fd, &ev);
+  } else {
+    epoll_ctl(this->_fd, EPOLL_CTL_ADD, client._fd, &ev);
+    client._initialized = true;
   }
 }
 
 void Server::poll(int tout) {
-  int nbrEvents = epoll_wait(_fd, &_events[0], _max_events, tout);
+  if (not _readable.empty())
+    tout = 0;
+  else if (tout == -1)
+    tout = _timeout();
+  int nbrEvents = _wait(tout);
+  auto woke = std::chrono::steady_clock::now();
+
+  // Clients cut off by readBatch last time go after the new events
+  std::vector<int> readable(_readable.begin(), _readable.end());
+  _readable.clear();
+  _depth = std::max(nbrEvents, 0) + readable.size();
 
   for (int idx = 0; idx < nbrEvents; idx++) {
     uint32_t event = _events[idx].events;
     int fd = _events[idx].data.fd;
-    if (fd == _sock) {
+    if (fd == _sock || fd == _tlsSock) {
 	  try {
-        Handler::acceptClient(_sock);
+        Handler::acceptClient(fd);
 	  }
 	  catch (std::exception &e) {
-       std::cerr << e.what() << std::endl;
+       Log::error("Accept failed: ", e.what());
 	  }
       continue;
     }
     for (uint32_t type : eventTypes) {
       if (_clients.count(fd) == 0)
-        return;
+        break;
       if (_clients.at(fd)->handler(type & event)) {
         [[maybe_unused]]
         auto fut = std::async(std::launch::async,
@@ -132,11 +234,224 @@ void Server::poll(int tout) {
       }
     }
 
-    if (event & (EPOLLRDHUP & EPOLLHUP))
-      removeClient(fd);
+    if ((event & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) && _clients.count(fd)) {
+      _metrics.hangups++;
+      _clients.at(fd)->evict(event & EPOLLERR ? "Connection error"
+                                              : "Remote host closed the connection");
+    }
+  }
+  if (nbrEvents == _max_events && _max_events < epollEventsMax) {
+    _max_events = std::min(_max_events * 2, epollEventsMax);
+    _events.resize(_max_events);
+    _metrics.epollGrows++;
+  }
+  for (int fd : readable) {
+    auto it = _clients.find(fd);
+    if (it == _clients.end() || it->second->isClosing())
+      continue;
+    try {
+      Handler::clientWrite(fd);
+    } catch (std::exception &e) {
+      Log::error("Read failed fd=", fd, ": ", e.what());
+    }
+  }
+  _runTimers();
+  _flushPending();
+  _shed();
+  while (not _evicted.empty()) {
+    _reapEvicted();
+    _flushPending();
+  }
+  _closeRemoved();
+  long busy = std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - woke).count();
+  _lag += (busy - _lag) / 8;
+}
+
+/*
+ * The loop is behind when the average time spent handling one batch of
+ * events, or the number of clients waiting in one, passes its limit
+ */
+bool Server::overloaded(void) const {
+  return (_lagLimit && _lag >= _lagLimit) || (_depthLimit && _depth >= _depthLimit);
+}
+
+long Server::loopLag(void) const { return _lag; }
+
+size_t Server::queueDepth(void) const { return _depth; }
+
+/*
+ * With busy_poll set, keep asking epoll without sleeping for that many
+ * microseconds first. A message that arrives meanwhile is handled without
+ * the wakeup latency of a sleeping thread, at the cost of a busy cpu.
+ */
+int Server::_wait(int tout) {
+  if (_busyPoll > 0 && tout != 0) {
+    long spin = tout > 0 ? std::min(_busyPoll, tout * 1000L) : _busyPoll;
+    auto end = std::chrono::steady_clock::now() + std::chrono::microseconds(spin);
+    do {
+      int nbrEvents = epoll_wait(_fd, &_events[0], _max_events, 0);
+      if (nbrEvents != 0) {
+        _metrics.spinHits++;
+        return nbrEvents;
+      }
+    } while (std::chrono::steady_clock::now() < end);
+    _metrics.spinMisses++;
+    if (tout > 0)
+      tout = std::max(0L, tout - spin / 1000);
   }
+  return epoll_wait(_fd, &_events[0], _max_events, tout);
+}
+
+void Server::addTimer(std::time_t interval, std::function<void()> task) {
+  _timers.push_back({interval, time(nullptr) + interval, std::move(task)});
 }
 
+int Server::_timeout(void) const {
+  if (_timers.empty())
+    return -1;
+  std::time_t now = time(nullptr), next = _timers.front().next;
+  for (const Timer &timer : _timers)
+    next = std::min(next, timer.next);
+  return next > now ? (next - now) * 1000 : 0;
+}
+
+void Server::_runTimers(void) {
+  std::time_t now = time(nullptr);
+  for (Timer &timer : _timers) {
+    if (timer.next > now)
+      continue;
+    timer.next = now + timer.interval;
+    timer.task();
+  }
+}
+
+/*
+ * Output is only queued while commands run, so every client gets at most one
+ * write per loop iteration. Anything the socket refuses waits for EPOLLOUT.
+ */
+void Server::_flushPending(void) {
+  std::vector<int> pending(_pending.begin(), _pending.end());
+  _pending.clear();
+  size_t chunk = Workers::chunk();
+  size_t chunks = (pending.size() + chunk - 1) / chunk;
+  std::vector<std::vector<int>> failed(chunks);
+
+  // Big flushes after a fan-out are written by the workers in chunks
+  Workers::run(chunks, [&](size_t idx) {
+    size_t end = std::min(pending.size(), (idx + 1) * chunk);
+    for (size_t pos = idx * chunk; pos < end; ++pos) {
+      auto it = _clients.find(pending[pos]);
+      if (it != _clients.end() && not it->second->flush())
+        failed[idx].push_back(pending[pos]);
+    }
+  });
+  for (auto &fds : failed)
+    for (int fd : fds)
+      _clients.at(fd)->evict("Write error");
+}
+
+/*
+ * Shed in steps while memory use nears the budget: history is trimmed
+ * first, from memoryRefuseAt on Admission turns new connections away, and
+ * past the budget the clients with the biggest sendqs are evicted until
+ * the rest is back under the refuse mark.
+ */
+void Server::_shed(void) {
+  if (Memory::pressure() == Memory::Normal)
+    return;
+  if (History::shrink())
+    _metrics.memoryTrims++;
+  if (Memory::pressure() != Memory::Evict)
+    return;
+  std::vector<Client *> clients;
+  for (auto &[fd, client] : _clients)
+    if (not client->isRemote() && not client->isClosing() && client->sendqBytes())
+      clients.push_back(client.get());
+  std::sort(clients.begin(), clients.end(), [](Client *a, Client *b) {
+    return a->sendqBytes() > b->sendqBytes();
+  });
+  size_t target = Memory::budget() / 100 * memoryRefuseAt;
+  size_t used = Memory::total();
+  for (Client *client : clients) {
+    if (used <= target)
+      break;
+    used -= std::min(used, client->sendqBytes());
+    _metrics.memoryEvictions++;
+    client->evict("Memory budget exceeded");
+  }
+}
+
+void Server::_reapEvicted(void) {
+  std::vector<int> evicted;
+  evicted.swap(_evicted);
+  for (int fd : evicted) {
+    auto it = _clients.find(fd);
+    if (it == _clients.end())
+      continue;
+    Log::info("Evicting client fd=", fd, " reason=", it->second->closeReason());
+    if (it->second->isLink())
+      Link::unlink(fd, it->second->closeReason());
+    else
+      it->second->getUser().quit(fd, it->second->closeReason());
+  }
+}
+
+void Server::markPending(int fd) { _pending.insert(fd); }
+
+void Server::markReadable(int fd) { _readable.insert(fd); }
+
+int Server::eventBatch(void) const { return _max_events; }
+
+void Server::markEvicted(int fd) { _evicted.push_back(fd); }
+
+/*
+ * listen() on a socket that is already listening only changes its backlog
+ */
+void Server::configure(const Settings &settings) {
+  _max_events = settings.epollEvents;
+  _events.resize(_max_events);
+  _busyPoll = settings.busyPoll;
+  _lagLimit = settings.overloadLag * 1000;
+  _depthLimit = settings.overloadQueue;
+  for (int sock : {_sock, _tlsSock})
+    if (sock != -1 && listen(sock, settings.backlog))
+      Log::warn("Config: cannot change the backlog of fd=", sock);
+  setSendQ(settings.sendqSoft, settings.sendqHard, settings.sendqGrace);
+  _admission.setLimits(settings.admit);
+  RecvParser::setLineMax(settings.lineMax);
+  Memory::setBudget(settings.memory);
+}
+
+void Server::expireSendq(void) {
+  std::time_t now = time(nullptr);
+  for (auto &[fd, client] : _clients)
+    if (not client->isClosing() && client->sendqExpired(now)) {
+      _metrics.sendqEvictions++;
+      client->evict("SendQ exceeded");
+    }
+}
+
+void Server::setSendQ(size_t soft, size_t hard, std::time_t grace) {
+  _sendqSoft = soft;
+  _sendqHard = hard;
+  _sendqGrace = grace;
+}
+
+size_t Server::getSendqSoft(void) const { return _sendqSoft; }
+
+size_t Server::getSendqHard(void) const { return _sendqHard; }
+
+std::time_t Server::getSendqGrace(void) const { return _sendqGrace; }
+
+Metrics &Server::metrics(void) { return _metrics; }
+
+Hitters &Server::hitters(void) { return _hitters; }
+
+Admission &Server::admission(void) { return _admission; }
+
+uint64_t Server::nextEpoch(void) { return ++_epoch; }
+
 void Server::registerHandler(const int fd, uint32_t eventType,
                              std::function<void(int)> handler) {
   if (_clients.count(fd) == 0)
@@ -147,7 +462,7 @@ void Server::registerHandler(const int fd, uint32_t eventType,
 
   for (uint32_t eventT : eventTypes) {
     if (eventT & eventType) {
-      cli->setHandler(eventType, handler);
+      cli->setHandler(eventT, handler);
     }
   }
 
@@ -172,3 +487,71 @@ Client *Server::getClient(int fd) {
 
   return (_clients.at(fd).get());
 }
+
+const std::string &Server::getName(void) const { return _name; }
+
+void Server::setName(const std::string &name) { _name = name; }
+
+const std::map<std::string, Channel> &Server::getChannels(void) const {
+  return _channels;
+}
+
+Client &Server::addRemote(int route) {
+  int id = _nextRemote++;
+  auto client = std::make_shared<Client>(id, route);
+  client->accessRegistered() = true;
+  _clients.try_emplace(id, client);
+  return *client;
+}
+
+/*
+ * Nicks are indexed by their lower-case Name. A string nobody's nick folds
+ * to was never interned, so a miss costs no allocation for the index.
+ */
+Client *Server::findNick(const std::string &nick) {
+  Name folded = Name::lookup(Name::lowercase(nick));
+  if (folded.empty())
+    return nullptr;
+  auto it = _nicks.find(folded);
+  if (it == _nicks.end())
+    return nullptr;
+  auto client = _clients.find(it->second);
+  if (client == _clients.end() || client->second->isLink())
+    return nullptr;
+  return client->second.get();
+}
+
+void Server::renameNick(int fd, const Name &from, const Name &to) {
+  if (auto it = _nicks.find(from.fold()); it != _nicks.end() && it->second == fd)
+    _nicks.erase(it);
+  if (not to.empty())
+    _nicks[to.fold()] = fd;
+}
+
+void Server::propagate(const std::string &line, int except) {
+  if (_links.empty())
+    return;
+  auto shared = std::make_shared<const std::string>(line + "\r\n");
+  for (int link : _links) {
+    if (link != except)
+      _clients.at(link)->queue(shared);
+  }
+}
+
+void Server::addLink(int fd) { _links.insert(fd); }
+
+const std::set<int> &Server::getLinks(void) const { return _links; }
+
+void Server::addServer(const std::string &name, int route) {
+  _servers[name] = route;
+}
+
+void Server::removeServer(const std::string &name) { _servers.erase(name); }
+
+bool Server::serverExists(const std::string &name) const {
+  return name == _name || _servers.contains(name);
+}
+
+const std::map<std::string, int> &Server::getServers(void) const {
+  return _servers;
+}
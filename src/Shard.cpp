@@ -0,0 +1,90 @@
+#include "Shard.hpp"
+#include "Log.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+
+/* Shards forked by shard 0, 0 once reaped */
+static pid_t	children[shardsMax];
+static size_t	childCount = 0;
+
+/**
+ * Reap exited shards only. Ignoring SIGCHLD would also reap the snapshot
+ * child, and Snapshot::save could no longer see whether its write failed.
+ */
+static void	reapShards(int)
+{
+	int saved = errno;
+
+	for (size_t idx = 0; idx < childCount; ++idx)
+		if (children[idx] > 0 && waitpid(children[idx], nullptr, WNOHANG) == children[idx])
+			children[idx] = 0;
+	errno = saved;
+}
+
+static void	pinTo(size_t shard)
+{
+	size_t cpus = std::max(1u, std::thread::hardware_concurrency());
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(shard % cpus, &set);
+	if (sched_setaffinity(0, sizeof(set), &set) == -1)
+		Log::warn("Shard ", shard, ": could not pin to cpu ", shard % cpus,
+			": ", strerror(errno));
+}
+
+/**
+ * Fork count - 1 more processes, before the server or the log thread exist
+ * @param pin	Pin shard n to cpu n
+ * @param links	Receives the sockets to link with: one per other shard in
+ * shard 0, the one to shard 0 in the others
+ * @return the index of this process, 0 for the original one
+ */
+size_t	Shard::spawn(size_t count, bool pin, std::vector<int> &links)
+{
+	for (size_t shard = 1; shard < count; ++shard)
+	{
+		int pair[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0, pair) == -1)
+			throw (std::runtime_error(std::string("Shard: socketpair: ") + strerror(errno)));
+		pid_t pid = fork();
+		if (pid == -1)
+			throw (std::runtime_error(std::string("Shard: fork: ") + strerror(errno)));
+		if (pid == 0)
+		{
+			prctl(PR_SET_PDEATHSIG, SIGINT);
+			for (int fd : links)
+				close(fd);
+			close(pair[0]);
+			links.assign(1, pair[1]);
+			if (pin)
+				pinTo(shard);
+			return shard;
+		}
+		close(pair[1]);
+		links.push_back(pair[0]);
+		children[childCount++] = pid;
+	}
+	if (childCount)
+	{
+		struct sigaction action{};
+		action.sa_handler = reapShards;
+		action.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+		sigemptyset(&action.sa_mask);
+		sigaction(SIGCHLD, &action, nullptr);
+		reapShards(0);
+	}
+	if (pin)
+		pinTo(0);
+	return 0;
+}
@@ -0,0 +1,221 @@
+#include "Snapshot.hpp"
+#include "Server.hpp"
+#include "Log.hpp"
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <optional>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+constexpr uint32_t snapshotVersion = 1;
+constexpr char snapshotMagic[8] = {'I', 'R', 'C', 'S', 'N', 'A', 'P', '\0'};
+
+static_assert(sizeof(SnapshotHeader) == 32, "SnapshotHeader layout changed");
+static_assert(sizeof(SnapshotRecord) == 48, "SnapshotRecord layout changed");
+
+pid_t Snapshot::_child = 0;
+
+namespace {
+	/* Buffers writes in a fixed array, nothing in here allocates */
+	struct	Writer
+	{
+		int		fd;
+		size_t	used = 0;
+		char	buf[1 << 16];
+
+		bool	flush(void)
+		{
+			for (size_t done = 0; done < used; )
+			{
+				ssize_t len = ::write(fd, buf + done, used - done);
+				if (len == -1 && errno != EINTR)
+					return false;
+				if (len > 0)
+					done += len;
+			}
+			used = 0;
+			return true;
+		}
+
+		bool	put(const void *data, size_t len)
+		{
+			const char *src = static_cast<const char *>(data);
+			while (len)
+			{
+				if (used == sizeof(buf) && not flush())
+					return false;
+				size_t chunk = std::min(len, sizeof(buf) - used);
+				std::memcpy(buf + used, src, chunk);
+				used += chunk;
+				src += chunk;
+				len -= chunk;
+			}
+			return true;
+		}
+	};
+}
+
+/**
+ * Write the snapshot to tmp and rename it over path. This runs in the forked
+ * child too, so it only reads the channels and makes system calls.
+ */
+static bool	writeFile(const char *tmp, const char *path)
+{
+	const std::map<std::string, Channel> &channels = irc->getChannels();
+	SnapshotHeader header{};
+	uint64_t strings = 0;
+
+	for (auto &channel : channels)
+		strings += channel.first.size() + channel.second.getTopic().size()
+			+ channel.second.getPassword().size();
+	std::memcpy(header.magic, snapshotMagic, sizeof(header.magic));
+	header.version = snapshotVersion;
+	header.count = channels.size();
+	header.strings = sizeof(header) + channels.size() * sizeof(SnapshotRecord);
+	header.size = header.strings + strings;
+
+	int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+	if (fd == -1)
+		return false;
+	static Writer out;
+	out.fd = fd;
+	out.used = 0;
+	bool ok = out.put(&header, sizeof(header));
+	uint32_t offset = 0;
+	for (auto &channel : channels)
+	{
+		const Channel &ch = channel.second;
+		SnapshotRecord record{};
+		record.created = ch.getCreated();
+		record.limit = ch.getLimit();
+		record.modes = ch.getModes();
+		record.name = offset;
+		record.nameLen = channel.first.size();
+		record.topic = record.name + record.nameLen;
+		record.topicLen = ch.getTopic().size();
+		record.key = record.topic + record.topicLen;
+		record.keyLen = ch.getPassword().size();
+		offset = record.key + record.keyLen;
+		ok = ok && out.put(&record, sizeof(record));
+	}
+	for (auto &channel : channels)
+	{
+		ok = ok && out.put(channel.first.data(), channel.first.size());
+		ok = ok && out.put(channel.second.getTopic().data(),
+			channel.second.getTopic().size());
+		ok = ok && out.put(channel.second.getPassword().data(),
+			channel.second.getPassword().size());
+	}
+	ok = ok && out.flush() && fsync(fd) == 0;
+	close(fd);
+	return ok && rename(tmp, path) == 0;
+}
+
+/**
+ * Save in a forked child so the event loop never waits for the disk. A save
+ * is skipped while the previous one is still being written.
+ */
+void	Snapshot::save(const std::string &path)
+{
+	int status;
+
+	if (_child > 0)
+	{
+		pid_t done = waitpid(_child, &status, WNOHANG);
+		if (done == 0)
+			return ;
+		if (done == _child && not (WIFEXITED(status) && WEXITSTATUS(status) == 0))
+			Log::error("Snapshot: failed to write ", path);
+		_child = 0;
+	}
+	const std::string tmp = path + ".tmp";
+	pid_t pid = fork();
+	if (pid == -1)
+		Log::error("Snapshot: fork failed: ", strerror(errno));
+	else if (pid == 0)
+		_exit(writeFile(tmp.c_str(), path.c_str()) ? 0 : 1);
+	else
+		_child = pid;
+}
+
+/**
+ * Save in the calling process, used on shutdown once the loop has stopped
+ */
+bool	Snapshot::write(const std::string &path)
+{
+	if (_child > 0)
+		waitpid(_child, nullptr, 0);
+	_child = 0;
+	const std::string tmp = path + ".tmp";
+	if (writeFile(tmp.c_str(), path.c_str()))
+		return true;
+	Log::error("Snapshot: failed to write ", path);
+	return false;
+}
+
+/**
+ * Map a snapshot and restore the channels in it. Records are read in place,
+ * only their string offsets are checked against the file size.
+ * @return Number of channels restored
+ */
+size_t	Snapshot::load(const std::string &path)
+{
+	int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	if (fd == -1)
+		return 0;
+	struct stat st{};
+	if (fstat(fd, &st) == -1 || static_cast<size_t>(st.st_size) < sizeof(SnapshotHeader))
+	{
+		close(fd);
+		return 0;
+	}
+	size_t size = st.st_size;
+	void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED)
+		return 0;
+
+	const char *base = static_cast<const char *>(map);
+	const SnapshotHeader *header = reinterpret_cast<const SnapshotHeader *>(base);
+	if (std::memcmp(header->magic, snapshotMagic, sizeof(header->magic))
+		|| header->version != snapshotVersion || header->size != size
+		|| header->strings != sizeof(SnapshotHeader)
+			+ uint64_t(header->count) * sizeof(SnapshotRecord)
+		|| header->strings > size)
+	{
+		munmap(map, size);
+		throw (std::runtime_error("Snapshot::load: " + path + " is not a valid snapshot"));
+	}
+	const SnapshotRecord *records =
+		reinterpret_cast<const SnapshotRecord *>(base + sizeof(SnapshotHeader));
+	const char *strings = base + header->strings;
+	const uint64_t stringsLen = size - header->strings;
+	auto view = [&](uint32_t offset, uint32_t len) -> std::optional<std::string_view> {
+		if (uint64_t(offset) + len > stringsLen)
+			return std::nullopt;
+		return std::string_view(strings + offset, len);
+	};
+
+	size_t restored = 0;
+	for (uint32_t idx = 0; idx < header->count; ++idx)
+	{
+		const SnapshotRecord &record = records[idx];
+		auto name = view(record.name, record.nameLen);
+		auto topic = view(record.topic, record.topicLen);
+		auto key = view(record.key, record.keyLen);
+		if (not name || not topic || not key || name->empty())
+			continue ;
+		Channel &ch = irc->addChannel(std::string(*name));
+		ch.setTime(record.created);
+		ch.restoreTopic(std::string(*topic));
+		ch.setPassword(std::string(*key));
+		ch.setLimit(size_t(record.limit));
+		ch.setModes(record.modes);
+		++restored;
+	}
+	munmap(map, size);
+	return restored;
+}
@@ -0,0 +1,41 @@
+#include "Socket.hpp"
+
+Socket::Ops	Socket::_ops = Socket::system();
+std::atomic<size_t>	Socket::_calls[Socket::Calls] = {};
+
+ssize_t	Socket::recv(int fd, void *buf, size_t len, int flags)
+{
+	_calls[Recv].fetch_add(1, std::memory_order_relaxed);
+	return _ops.recv(fd, buf, len, flags);
+}
+
+ssize_t	Socket::send(int fd, const void *buf, size_t len, int flags)
+{
+	_calls[Send].fetch_add(1, std::memory_order_relaxed);
+	return _ops.send(fd, buf, len, flags);
+}
+
+ssize_t	Socket::sendmsg(int fd, const struct msghdr *msg, int flags)
+{
+	_calls[Send].fetch_add(1, std::memory_order_relaxed);
+	return _ops.sendmsg(fd, msg, flags);
+}
+
+void	Socket::install(const Ops &ops)
+{
+	_ops = ops;
+}
+
+/**
+ * @return the functions of the kernel, installed unless replaced
+ */
+const Socket::Ops	&Socket::system(void)
+{
+	static const Ops ops = {::recv, ::send, ::sendmsg};
+	return ops;
+}
+
+size_t	Socket::calls(Call call)
+{
+	return _calls[call].load(std::memory_order_relaxed);
+}
@@ -0,0 +1,210 @@
+#include "Tls.hpp"
+#include "Log.hpp"
+#include <algorithm>
+#include <atomic>
+#include <stdexcept>
+#include <string>
+
+#ifdef IRCSERV_TLS
+#include <openssl/ssl.h>
+#include <openssl/err.h>
+
+namespace
+{
+	SSL_CTX	*context = nullptr;
+	// Counted from the fan-out workers too, through encrypt()
+	std::atomic<size_t>	full = 0;
+	std::atomic<size_t>	resumed = 0;
+	std::atomic<size_t>	failed = 0;
+
+	/* Formats the oldest error of the calling thread's OpenSSL queue into a
+	 * buffer of its own, flushes from several workers fail at once */
+	std::string	error(void)
+	{
+		char buf[256];
+
+		ERR_error_string_n(ERR_get_error(), buf, sizeof(buf));
+		return buf;
+	}
+}
+
+/**
+ * Load the certificate and key and set up session resumption, once at
+ * startup before any TLS client connects
+ */
+bool	Tls::init(const std::string &cert, const std::string &key)
+{
+	static const unsigned char sessionContext[] = "ircserv";
+
+	context = SSL_CTX_new(TLS_server_method());
+	if (not context)
+		return Log::error("TLS: ", error()), false;
+	SSL_CTX_set_min_proto_version(context, TLS1_2_VERSION);
+	SSL_CTX_set_mode(context, SSL_MODE_ENABLE_PARTIAL_WRITE
+		| SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER | SSL_MODE_RELEASE_BUFFERS);
+	SSL_CTX_set_session_cache_mode(context, SSL_SESS_CACHE_SERVER);
+	SSL_CTX_sess_set_cache_size(context, 1 << 14);
+	SSL_CTX_set_timeout(context, 3600);
+	SSL_CTX_set_session_id_context(context, sessionContext, sizeof(sessionContext) - 1);
+	if (SSL_CTX_use_certificate_chain_file(context, cert.c_str()) != 1
+		|| SSL_CTX_use_PrivateKey_file(context, key.c_str(), SSL_FILETYPE_PEM) != 1
+		|| SSL_CTX_check_private_key(context) != 1)
+	{
+		Log::error("TLS: ", cert, ": ", error());
+		SSL_CTX_free(context);
+		context = nullptr;
+		return false;
+	}
+	return true;
+}
+
+bool	Tls::enabled(void)
+{
+	return context != nullptr;
+}
+
+Tls::Tls(void)
+	: _ssl(SSL_new(context)), _in(BIO_new(BIO_s_mem())), _out(BIO_new(BIO_s_mem()))
+{
+	if (not _ssl || not _in || not _out)
+	{
+		BIO_free(_in);
+		BIO_free(_out);
+		SSL_free(_ssl);
+		throw (std::runtime_error("Tls: out of memory"));
+	}
+	BIO_set_mem_eof_return(_in, -1);
+	SSL_set_bio(_ssl, _in, _out);
+	SSL_set_accept_state(_ssl);
+}
+
+/*
+ * A connection that simply closes would take its session out of the cache,
+ * marking it shut down keeps it resumable
+ */
+Tls::~Tls(void)
+{
+	if (_established)
+		SSL_set_shutdown(_ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+	SSL_free(_ssl);
+}
+
+/**
+ * Count the handshake once it completes
+ * @return false if the connection failed and has to be closed
+ */
+bool	Tls::_check(int ret)
+{
+	if (not _established && SSL_is_init_finished(_ssl))
+	{
+		_established = true;
+		SSL_session_reused(_ssl) ? ++resumed : ++full;
+	}
+	if (ret > 0)
+		return true;
+	int err = SSL_get_error(_ssl, ret);
+	if (err == SSL_ERROR_WANT_READ || err == SSL_ERROR_WANT_WRITE
+		|| err == SSL_ERROR_ZERO_RETURN)
+		return true;
+	if (not _established)
+		++failed;
+	Log::debug("TLS: ", error());
+	ERR_clear_error();
+	return false;
+}
+
+/**
+ * Feed bytes received from the socket, whatever they complete of the
+ * handshake or of application data is processed
+ * @param plain	Receives the decrypted data
+ * @return false on a protocol error
+ */
+bool	Tls::decrypt(const char *data, size_t len, std::string &plain)
+{
+	char buf[16384];
+
+	if (len && BIO_write(_in, data, len) != int(len))
+		return false;
+	for (;;)
+	{
+		int ret = SSL_read(_ssl, buf, sizeof(buf));
+		if (ret <= 0)
+			return _check(ret);
+		_check(ret);
+		plain.append(buf, ret);
+	}
+}
+
+/**
+ * Turn plain text into records, drain() returns them. Only call once the
+ * handshake is established, the memory buffer takes any amount of data.
+ */
+bool	Tls::encrypt(const std::string &plain)
+{
+	size_t done = 0;
+
+	while (done < plain.size())
+	{
+		int ret = SSL_write(_ssl, plain.data() + done, plain.size() - done);
+		if (ret <= 0)
+			return _check(ret), false;
+		done += ret;
+	}
+	return true;
+}
+
+/**
+ * @return records waiting to be sent, handshake messages included
+ */
+std::string	Tls::drain(void)
+{
+	std::string ret(BIO_ctrl_pending(_out), '\0');
+
+	if (not ret.empty())
+		ret.resize(std::max(0, BIO_read(_out, ret.data(), ret.size())));
+	return ret;
+}
+
+bool	Tls::established(void) const
+{
+	return _established;
+}
+
+size_t	Tls::fullHandshakes(void)
+{
+	return full;
+}
+
+size_t	Tls::resumedHandshakes(void)
+{
+	return resumed;
+}
+
+size_t	Tls::failedHandshakes(void)
+{
+	return failed;
+}
+
+#else
+
+bool	Tls::init(const std::string &cert, const std::string &key)
+{
+	(void)cert;
+	(void)key;
+	Log::error("TLS: built without TLS support, rebuild with make TLS=1");
+	return false;
+}
+
+bool	Tls::enabled(void) { return false; }
+Tls::Tls(void) {}
+Tls::~Tls(void) {}
+bool	Tls::_check(int ret) { return ret > 0; }
+bool	Tls::decrypt(const char *, size_t, std::string &) { return false; }
+bool	Tls::encrypt(const std::string &) { return false; }
+std::string	Tls::drain(void) { return ""; }
+bool	Tls::established(void) const { return false; }
+size_t	Tls::fullHandshakes(void) { return 0; }
+size_t	Tls::resumedHandshakes(void) { return 0; }
+size_t	Tls::failedHandshakes(void) { return 0; }
+
+#endif
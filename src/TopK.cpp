@@ -0,0 +1,156 @@
+#include "TopK.hpp"
+#include <algorithm>
+
+/* The unused buckets are chained through next, starting at spare */
+TopK::Window::Window(void)
+{
+	for (size_t idx = 0; idx < topSlots; ++idx)
+		buckets[idx].next = idx + 1 < topSlots ? idx + 1 : -1;
+}
+
+/**
+ * Take a slot out of its bucket, the bucket goes back to the spares once
+ * it is empty
+ * @return the nearest bucket below the slot's count, -1 if there is none
+ */
+int	TopK::Window::detach(int slot)
+{
+	Slot &entry = slots[slot];
+	Bucket &bucket = buckets[entry.bucket];
+	int below = entry.bucket;
+
+	if (entry.prev != -1)
+		slots[entry.prev].next = entry.next;
+	else
+		bucket.first = entry.next;
+	if (entry.next != -1)
+		slots[entry.next].prev = entry.prev;
+	if (bucket.first == -1)
+	{
+		below = bucket.prev;
+		if (bucket.prev != -1)
+			buckets[bucket.prev].next = bucket.next;
+		else
+			lowest = bucket.next;
+		if (bucket.next != -1)
+			buckets[bucket.next].prev = bucket.prev;
+		bucket.next = spare;
+		spare = entry.bucket;
+	}
+	entry.bucket = -1;
+	return below;
+}
+
+/**
+ * Put a slot into the bucket of count, searching upwards from the bucket
+ * after, a bucket with a lower count, or from the lowest one if it is -1
+ */
+void	TopK::Window::place(int slot, size_t count, int after)
+{
+	int at = after == -1 ? lowest : buckets[after].next;
+
+	while (at != -1 && buckets[at].count < count)
+	{
+		after = at;
+		at = buckets[at].next;
+	}
+	if (at == -1 || buckets[at].count != count)
+	{
+		int fresh = spare;
+		spare = buckets[fresh].next;
+		buckets[fresh] = {count, -1, after, at};
+		if (after != -1)
+			buckets[after].next = fresh;
+		else
+			lowest = fresh;
+		if (at != -1)
+			buckets[at].prev = fresh;
+		at = fresh;
+	}
+	Slot &entry = slots[slot];
+	entry.bucket = at;
+	entry.prev = -1;
+	entry.next = buckets[at].first;
+	if (entry.next != -1)
+		slots[entry.next].prev = slot;
+	buckets[at].first = slot;
+}
+
+void	TopK::Window::raise(int slot, size_t weight)
+{
+	size_t count = buckets[slots[slot].bucket].count + weight;
+
+	place(slot, count, detach(slot));
+}
+
+void	TopK::Window::collect(std::vector<Entry> &out) const
+{
+	for (size_t idx = 0; idx < used; ++idx)
+		out.push_back({slots[idx].name, buckets[slots[idx].bucket].count,
+			slots[idx].error});
+}
+
+void	TopK::add(const Name &name, size_t weight)
+{
+	Window &window = _current;
+
+	if (name.empty())
+		return ;
+	if (auto it = window.index.find(name); it != window.index.end())
+		return window.raise(it->second, weight);
+	if (window.used < topSlots)
+	{
+		int slot = window.used++;
+		window.slots[slot].name = name;
+		window.index.emplace(name, slot);
+		return window.place(slot, weight, -1);
+	}
+	int slot = window.buckets[window.lowest].first;
+	Slot &entry = window.slots[slot];
+	window.index.erase(entry.name);
+	window.index.emplace(name, slot);
+	entry.name = name;
+	entry.error = window.buckets[window.lowest].count;
+	window.raise(slot, weight);
+}
+
+void	TopK::rotate(void)
+{
+	_previous = std::move(_current);
+	_current = Window();
+}
+
+std::vector<TopK::Entry>	TopK::top(size_t count) const
+{
+	std::vector<Entry> merged, current;
+	std::unordered_map<Name, size_t, Name::Hash> index;
+
+	_previous.collect(merged);
+	_current.collect(current);
+	for (size_t idx = 0; idx < merged.size(); ++idx)
+		index.emplace(merged[idx].name, idx);
+	for (const Entry &entry : current)
+	{
+		auto it = index.find(entry.name);
+		if (it == index.end())
+		{
+			index.emplace(entry.name, merged.size());
+			merged.push_back(entry);
+			continue ;
+		}
+		merged[it->second].count += entry.count;
+		merged[it->second].error += entry.error;
+	}
+	count = std::min(count, merged.size());
+	std::partial_sort(merged.begin(), merged.begin() + count, merged.end(),
+		[](const Entry &a, const Entry &b) { return a.count > b.count; });
+	merged.resize(count);
+	return merged;
+}
+
+void	Hitters::rotate(void)
+{
+	messages.rotate();
+	bytes.rotate();
+	channels.rotate();
+}
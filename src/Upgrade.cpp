@@ -0,0 +1,374 @@
+#include "Upgrade.hpp"
+#include "Server.hpp"
+#include "Log.hpp"
+#include "Link.hpp"
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+/* Largest record, big data is sent in chunks below this size */
+constexpr size_t recordMax = 1 << 16;
+constexpr size_t chunkMax = 32 * 1024;
+/* Seconds the old process waits for the new one to take over */
+constexpr int handoffTimeout = 10;
+
+namespace {
+	enum	Record : uint8_t
+	{
+		LISTEN,
+		LINK,
+		CLIENT,
+		OUTPUT,
+		INPUT,
+		REMOTE,
+		SERVER,
+		CHANNEL,
+		MEMBERS,
+		INVITES,
+		END
+	};
+
+	struct	Packer
+	{
+		std::string	buf;
+
+		explicit Packer(Record type) { buf += static_cast<char>(type); }
+		void	u8(uint8_t val) { buf += static_cast<char>(val); }
+		void	u64(uint64_t val) { buf.append(reinterpret_cast<char *>(&val), sizeof(val)); }
+		void	str(const std::string &val) { u64(val.size()); buf += val; }
+	};
+
+	struct	Unpacker
+	{
+		const char	*pos;
+		const char	*end;
+
+		void	need(size_t len)
+		{
+			if (static_cast<size_t>(end - pos) < len)
+				throw (std::runtime_error("Upgrade: truncated record"));
+		}
+		uint8_t	u8(void) { need(1); return *pos++; }
+		uint64_t	u64(void)
+		{
+			uint64_t val;
+			need(sizeof(val));
+			std::memcpy(&val, pos, sizeof(val));
+			pos += sizeof(val);
+			return val;
+		}
+		std::string	str(void)
+		{
+			uint64_t len = u64();
+			need(len);
+			std::string val(pos, len);
+			pos += len;
+			return val;
+		}
+	};
+
+	bool	sendRecord(int sock, const Packer &rec, int fd = -1)
+	{
+		struct iovec iov{const_cast<char *>(rec.buf.data()), rec.buf.size()};
+		struct msghdr hdr{};
+		alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))]{};
+		hdr.msg_iov = &iov;
+		hdr.msg_iovlen = 1;
+		if (fd != -1)
+		{
+			hdr.msg_control = control;
+			hdr.msg_controllen = sizeof(control);
+			struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_RIGHTS;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+			std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+		}
+		return sendmsg(sock, &hdr, MSG_NOSIGNAL) == static_cast<ssize_t>(rec.buf.size());
+	}
+
+	/* @return the record type, fd is -1 unless a descriptor came with it */
+	Record	recvRecord(int sock, std::string &buf, int &fd)
+	{
+		struct iovec iov{buf.data(), buf.size()};
+		struct msghdr hdr{};
+		alignas(struct cmsghdr) char control[CMSG_SPACE(sizeof(int))]{};
+		hdr.msg_iov = &iov;
+		hdr.msg_iovlen = 1;
+		hdr.msg_control = control;
+		hdr.msg_controllen = sizeof(control);
+		ssize_t len = recvmsg(sock, &hdr, MSG_CMSG_CLOEXEC);
+		if (len <= 0 || hdr.msg_flags & (MSG_TRUNC | MSG_CTRUNC))
+			throw (std::runtime_error("Upgrade: failed to receive state"));
+		fd = -1;
+		if (struct cmsghdr *cmsg = CMSG_FIRSTHDR(&hdr);
+			cmsg && cmsg->cmsg_type == SCM_RIGHTS)
+			std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+		buf.resize(len);
+		return static_cast<Record>(buf[0]);
+	}
+
+	bool	sendChunks(int sock, Record type, int id, const std::string &data)
+	{
+		for (size_t pos = 0; pos < data.size(); pos += chunkMax)
+		{
+			Packer rec(type);
+			rec.u64(id);
+			rec.str(data.substr(pos, chunkMax));
+			if (not sendRecord(sock, rec))
+				return false;
+		}
+		return true;
+	}
+
+	bool	sendMembers(int sock, Record type, const Channel &ch,
+		const std::set<int> &ids, uint8_t oper)
+	{
+		auto it = ids.begin();
+		while (it != ids.end())
+		{
+			Packer rec(type);
+			rec.str(ch.getName());
+			for (size_t count = 0; it != ids.end() && count < 2048; ++it, ++count)
+			{
+				rec.u64(*it);
+				rec.u8(oper);
+			}
+			if (not sendRecord(sock, rec))
+				return false;
+		}
+		return true;
+	}
+
+	bool	sendState(int sock)
+	{
+		Packer listen(LISTEN);
+		listen.u64(irc->getStartTime());
+		if (not sendRecord(sock, listen, irc->getListenFd()))
+			return false;
+		for (auto &entry : irc->getClients())
+		{
+			Client &client = *entry.second;
+			if (client.isRemote() || client.isClosing())
+				continue ;
+			User &user = client.getUser();
+			Packer rec(client.isLink() ? LINK : CLIENT);
+			rec.u64(client._fd);
+			rec.str(client.isLink() ? client.getServer() : user.getNick());
+			rec.str(user.getUser());
+			rec.str(user.getHost());
+			rec.str(client.getAddress());
+			rec.u64(user.getSignon());
+			rec.u8(client.isAuthenticated());
+			rec.u8(client.accessRegistered());
+			if (not sendRecord(sock, rec, client._fd)
+				|| not sendChunks(sock, INPUT, client._fd, client.getParser().pending())
+				|| not sendChunks(sock, OUTPUT, client._fd, client.pendingOutput()))
+				return false;
+		}
+		for (auto &entry : irc->getClients())
+		{
+			Client &client = *entry.second;
+			if (not client.isRemote())
+				continue ;
+			User &user = client.getUser();
+			Packer rec(REMOTE);
+			rec.u64(client._fd);
+			rec.u64(client.route());
+			rec.str(client.getServer());
+			rec.str(user.getNick());
+			rec.str(user.getUser());
+			rec.str(user.getHost());
+			rec.u64(user.getSignon());
+			if (not sendRecord(sock, rec))
+				return false;
+		}
+		for (auto &server : irc->getServers())
+		{
+			Packer rec(SERVER);
+			rec.str(server.first);
+			rec.u64(server.second);
+			if (not sendRecord(sock, rec))
+				return false;
+		}
+		for (auto &entry : irc->getChannels())
+		{
+			const Channel &ch = entry.second;
+			Packer rec(CHANNEL);
+			rec.str(ch.getName());
+			rec.u64(ch.getCreated());
+			rec.str(ch.getTopic());
+			rec.str(ch.getPassword());
+			rec.u64(ch.getLimit());
+			rec.u64(ch.getModes());
+			if (not sendRecord(sock, rec)
+				|| not sendMembers(sock, MEMBERS, ch, ch.getOperators(), 1)
+				|| not sendMembers(sock, MEMBERS, ch, ch.getUsers(), 0)
+				|| not sendMembers(sock, INVITES, ch, ch.getInvited(), 0))
+				return false;
+		}
+		return sendRecord(sock, Packer(END));
+	}
+}
+
+/**
+ * Exec argv in a child and hand everything over to it
+ * @return true once the new process took over, the caller should exit
+ * without touching any connection
+ */
+bool	Upgrade::start(char **argv)
+{
+	int pair[2];
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, pair) == -1)
+		throw (std::runtime_error(std::string("Upgrade: socketpair: ") + strerror(errno)));
+	pid_t pid = fork();
+	if (pid == -1)
+	{
+		close(pair[0]);
+		close(pair[1]);
+		throw (std::runtime_error(std::string("Upgrade: fork: ") + strerror(errno)));
+	}
+	if (pid == 0)
+	{
+		fcntl(pair[1], F_SETFD, 0);
+		setenv(handoffEnv, std::to_string(pair[1]).c_str(), 1);
+		execv(argv[0], argv);
+		_exit(127);
+	}
+	close(pair[1]);
+	Log::info("Upgrade: handing over to ", argv[0], " pid=", pid);
+
+	std::vector<int> tls;
+	for (auto &entry : irc->getClients())
+		if (entry.second->isTls() && not entry.second->isClosing())
+			tls.push_back(entry.first);
+	for (int fd : tls)
+		Link::kill(*irc->getClient(fd), "Server upgrade");
+	for (auto &entry : irc->getClients())
+		entry.second->flush();
+	struct timeval timeout{handoffTimeout, 0};
+	setsockopt(pair[0], SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	char ack = 0;
+	bool done = sendState(pair[0]) && recv(pair[0], &ack, 1, 0) == 1 && ack == 'K';
+	close(pair[0]);
+	if (done)
+		return true;
+	Log::error("Upgrade: new process did not take over, carrying on");
+	kill(pid, SIGKILL);
+	waitpid(pid, nullptr, 0);
+	return false;
+}
+
+/**
+ * Rebuild the server from the state an old process sends over sock. Ids
+ * are remapped, received sockets get new descriptor numbers and remote
+ * users new ids.
+ */
+Server	*Upgrade::resume(int sock, const std::string &port, const std::string &passwd)
+{
+	std::string buf(recordMax, '\0');
+	std::map<uint64_t, int> ids;
+	int fd;
+
+	if (recvRecord(sock, buf, fd) != LISTEN || fd == -1)
+		throw (std::runtime_error("Upgrade: expected the listening socket"));
+	Unpacker in{buf.data() + 1, buf.data() + buf.size()};
+	Server *server = new Server(port, passwd, fd);
+	irc = server;
+	irc->setStartTime(in.u64());
+
+	auto lookup = [&](uint64_t id) {
+		auto it = ids.find(id);
+		if (it == ids.end())
+			throw (std::runtime_error("Upgrade: unknown id " + std::to_string(id)));
+		return it->second;
+	};
+	for (buf.resize(recordMax); ; buf.resize(recordMax))
+	{
+		Record type = recvRecord(sock, buf, fd);
+		in = {buf.data() + 1, buf.data() + buf.size()};
+		if (type == END)
+			break ;
+		if (type == LINK || type == CLIENT)
+		{
+			uint64_t id = in.u64();
+			if (fd == -1)
+				throw (std::runtime_error("Upgrade: client without a socket"));
+			Handler::registerClient(fd);
+			Client *client = irc->getClient(fd);
+			User &user = client->getUser();
+			std::string name = in.str();
+			user.setUser(in.str());
+			user.setHost(in.str());
+			client->setAddress(in.str());
+			if (type == CLIENT)
+				irc->admission().track(fd, inet_addr(client->getAddress().c_str()));
+			user.setSignon(in.u64());
+			if (in.u8())
+				client->authenticate();
+			client->accessRegistered() = in.u8();
+			if (type == LINK)
+			{
+				client->makeLink(name);
+				irc->addLink(fd);
+			}
+			else
+				user.setNick(fd, name);
+			ids[id] = fd;
+		}
+		else if (type == INPUT || type == OUTPUT)
+		{
+			Client *client = irc->getClient(lookup(in.u64()));
+			if (type == INPUT)
+			{
+				client->getParser().restore(in.str());
+				client->account();
+			}
+			else
+				client->queue(in.str());
+		}
+		else if (type == REMOTE)
+		{
+			uint64_t id = in.u64();
+			Client &client = irc->addRemote(lookup(in.u64()));
+			User &user = client.getUser();
+			client.setServer(in.str());
+			user.setNick(client._fd, in.str());
+			user.setUser(in.str());
+			user.setHost(in.str());
+			user.setSignon(in.u64());
+			ids[id] = client._fd;
+		}
+		else if (type == SERVER)
+		{
+			std::string name = in.str();
+			irc->addServer(name, lookup(in.u64()));
+		}
+		else if (type == CHANNEL)
+		{
+			Channel &ch = irc->addChannel(in.str());
+			ch.setTime(in.u64());
+			ch.restoreTopic(in.str());
+			ch.setPassword(in.str());
+			ch.setLimit(size_t(in.u64()));
+			ch.setModes(in.u64());
+		}
+		else if (type == MEMBERS || type == INVITES)
+		{
+			Channel *ch = irc->findChannel(in.str());
+			while (ch && in.pos < in.end)
+			{
+				int id = lookup(in.u64());
+				bool oper = in.u8();
+				type == MEMBERS ? (void)ch->addMember(id, oper) : ch->invite(id);
+			}
+		}
+	}
+	char ack = 'K';
+	if (send(sock, &ack, 1, MSG_NOSIGNAL) != 1)
+		throw (std::runtime_error("Upgrade: failed to acknowledge the handoff"));
+	close(sock);
+	return server;
+}
@@ -4,45 +4,91 @@ void User::join(Channel *chan) {
 	_channels.push_back(chan);
 }
 
-void User::quit(int fd, string msg) {
-	for (auto channels : _channels) {
-		channels->removeUser(fd, msg, "QUIT");
+void User::quit(int fd, const string &msg) {
+	Client *client = irc->getClient(fd);
+	if (not _nick.empty() && client->accessRegistered())
+		irc->propagate(":" + _nick.str() + " QUIT :" + msg, client->route());
+	notifyPeers(fd, _prefix + " QUIT :" + msg);
+	vector<Channel*> channels = _channels;
+	for (auto channels : channels) {
+		channels->leave(fd);
 	}
 	irc->removeClient(fd);
 }
 
-void User::setNick(int fd, string name) {
-	for (auto channels : _channels) {
-		channels->message(fd, createPrefix(), "NICK", name);
+/*
+ * @brief Send line once to every local user sharing a channel with fd, no
+ * matter how many channels they share
+ */
+void User::notifyPeers(int fd, const string &line) {
+	uint64_t epoch = irc->nextEpoch();
+	auto shared = std::make_shared<const string>(line + "\r\n");
+
+	irc->getClient(fd)->visit(epoch);
+	for (auto channel : _channels) {
+		for (const set<int> *members : {&channel->getUsers(), &channel->getOperators()}) {
+			for (int member : *members) {
+				Client *peer = irc->getClient(member);
+				if (not peer->isRemote() && peer->visit(epoch))
+					peer->queue(shared);
+			}
+		}
 	}
-	_nick = name;
 }
 
-void User::setUser(string name) {
-	_user = name;
+void User::setNick(int fd, const string &name) {
+	notifyPeers(fd, _prefix + " NICK :" + name);
+	Name nick(name);
+	irc->renameNick(fd, _nick, nick);
+	_nick = std::move(nick);
+	_updatePrefix();
+	for (auto channels : _channels)
+		channels->refresh(fd);
+}
+
+void User::setUser(const string &name) {
+	_user = Name(name);
+	_updatePrefix();
+}
+
+void User::setHost(const string &host) {
+	_hostname = Name(host);
+	_updatePrefix();
 }
 
-void User::setHost(string host) {
-	_hostname = host;
+const string& User::getNick(void) const {
+	return _nick.str();
 }
 
-string User::getNick(void) const {
+const Name& User::nickName(void) const {
 	return _nick;
 }
 
-string User::getUser(void) const {
-	return _user;
+const string& User::getUser(void) const {
+	return _user.str();
 }
 
-string User::getHost(void) const {
-	return _hostname;
+const string& User::getHost(void) const {
+	return _hostname.str();
 }
 
-string User::createPrefix(void) const {
-	return (":" + _nick + "!" + _user + "@" + _hostname);
+time_t User::getSignon(void) const {
+	return _signon;
 }
 
-Channel* User::getChannel(string needle) {
+void User::setSignon(time_t signon) {
+	_signon = signon;
+}
+
+void User::_updatePrefix(void) {
+	_prefix = ":" + _nick.str() + "!" + _user.str() + "@" + _hostname.str();
+}
+
+const string& User::getPrefix(void) const {
+	return _prefix;
+}
+
+Channel* User::getChannel(const string &needle) {
 	for (auto channel : _channels) {
 		if (channel->getName() == needle)
 			return channel;
@@ -50,8 +96,12 @@ Channel* User::getChannel(string needle) {
 	return nullptr;
 }
 
-void User::exitChannel(string needle) {
-	for (int idx = 0; _channels[idx]; idx++) {
+const vector<Channel*>& User::getChannels(void) const {
+	return _channels;
+}
+
+void User::exitChannel(const string &needle) {
+	for (size_t idx = 0; idx < _channels.size(); idx++) {
 		if (_channels[idx]->getName() == needle) {
 			_channels.erase(_channels.begin() + idx);
 			break;
@@ -0,0 +1,90 @@
+#include "Welcome.hpp"
+#include "Config.hpp"
+#include "Fanout.hpp"
+#include "History.hpp"
+#include <fstream>
+
+std::vector<std::string>	Welcome::_burst;
+std::vector<std::string>	Welcome::_motd;
+
+/* Append "numeric <nick> text" to a block of pieces */
+static void	line(std::vector<std::string> &pieces, const char *numeric,
+	const std::string &text)
+{
+	pieces.back() += std::string(numeric) + " ";
+	pieces.push_back(" " + text + "\r\n");
+}
+
+static std::vector<std::string>	motdBlock(const std::string &server,
+	const std::string &path)
+{
+	std::vector<std::string> pieces{""};
+	std::ifstream file(path);
+
+	if (not file)
+	{
+		line(pieces, "422", ":MOTD File is missing");
+		return pieces;
+	}
+	line(pieces, "375", ":- " + server + " Message of the day -");
+	for (std::string text; std::getline(file, text); )
+	{
+		if (not text.empty() && text.back() == '\r')
+			text.pop_back();
+		line(pieces, "372", ":- " + text.substr(0, 400));
+	}
+	line(pieces, "376", ":End of /MOTD command.");
+	return pieces;
+}
+
+void	Welcome::build(const std::string &server, const std::string &created,
+	const Settings &settings)
+{
+	std::vector<std::string> pieces{""};
+	const std::string targmax = std::to_string(targmaxMessage);
+	const std::string chanmax = std::to_string(targmaxChannel);
+
+	line(pieces, "001", ":Welcome to Hive network");
+	line(pieces, "002", ":Your host is " + server + ", running version " + serverVersion);
+	line(pieces, "003", ":This server was created " + created);
+	line(pieces, "004", server + " " + serverVersion + " o iklost");
+	line(pieces, "005", "CHANTYPES=# CASEMAPPING=ascii PREFIX=(o)@ CHANMODES=,k,l,it"
+		" NICKLEN=" + std::to_string(settings.nickMax)
+		+ " CHANNELLEN=" + std::to_string(settings.channelMax + 1)
+		+ " TARGMAX=PRIVMSG:" + targmax + ",NOTICE:" + targmax
+		+ ",JOIN:" + chanmax + ",PART:" + chanmax
+		+ " CHATHISTORY=" + std::to_string(historyReplyMax)
+		+ " :are supported by this server");
+	_motd = motdBlock(server, settings.motdFile);
+	pieces.back() += _motd.front();
+	pieces.insert(pieces.end(), _motd.begin() + 1, _motd.end());
+	_burst = std::move(pieces);
+}
+
+std::string	Welcome::_fill(const std::vector<std::string> &pieces,
+	const std::string &nick)
+{
+	std::string out;
+	size_t size = 0;
+
+	for (const std::string &piece : pieces)
+		size += piece.size() + nick.size();
+	out.reserve(size);
+	for (size_t idx = 0; idx < pieces.size(); ++idx)
+	{
+		if (idx)
+			out += nick;
+		out += pieces[idx];
+	}
+	return out;
+}
+
+std::string	Welcome::burst(const std::string &nick)
+{
+	return _fill(_burst, nick);
+}
+
+std::string	Welcome::motd(const std::string &nick)
+{
+	return _fill(_motd, nick);
+}
@@ -0,0 +1,126 @@
+#include "Workers.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace
+{
+	std::vector<std::thread>	pool;
+	std::mutex					lock;
+	std::condition_variable		wake;
+	std::condition_variable		done;
+	const std::function<void(size_t)>	*job = nullptr;
+	size_t						jobTasks = 0;
+	uint64_t					generation = 0;
+	std::atomic<size_t>			next{0};
+	size_t						busy = 0;
+	size_t						finished = 0;
+	bool						stopping = false;
+	size_t						chunkSize = fanoutChunk;
+
+	/* Take task indexes until none are left */
+	size_t	drain(const std::function<void(size_t)> &task, size_t tasks)
+	{
+		size_t count = 0;
+
+		for (size_t idx = next++; idx < tasks; idx = next++, ++count)
+			task(idx);
+		return count;
+	}
+
+	/*
+	 * A worker that wakes up after run() returned finds no job. One that got
+	 * the job counts as busy until it is out of drain(), so run() cannot
+	 * start the next job while it still holds the old one.
+	 */
+	void	work(void)
+	{
+		uint64_t seen = 0;
+		std::unique_lock<std::mutex> guard(lock);
+
+		for (;;)
+		{
+			wake.wait(guard, [&] { return stopping || generation != seen; });
+			if (stopping)
+				return ;
+			seen = generation;
+			if (not job)
+				continue ;
+			const std::function<void(size_t)> *task = job;
+			size_t tasks = jobTasks;
+			++busy;
+			guard.unlock();
+			size_t count = drain(*task, tasks);
+			guard.lock();
+			finished += count;
+			if (--busy == 0 && finished == jobTasks)
+				done.notify_one();
+		}
+	}
+}
+
+void	Workers::start(size_t threads)
+{
+	threads = std::min(threads, fanoutThreadsMax);
+	for (size_t idx = 0; idx < threads; ++idx)
+		pool.emplace_back(work);
+}
+
+void	Workers::stop(void)
+{
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for (std::thread &thread : pool)
+		thread.join();
+	pool.clear();
+	stopping = false;
+}
+
+size_t	Workers::threads(void)
+{
+	return pool.size();
+}
+
+/**
+ * Call task(0) .. task(tasks - 1) spread over the pool and this thread
+ */
+void	Workers::run(size_t tasks, const std::function<void(size_t)> &task)
+{
+	if (pool.empty() || tasks < 2)
+	{
+		for (size_t idx = 0; idx < tasks; ++idx)
+			task(idx);
+		return ;
+	}
+	{
+		std::lock_guard<std::mutex> guard(lock);
+		job = &task;
+		jobTasks = tasks;
+		finished = 0;
+		next = 0;
+		++generation;
+	}
+	wake.notify_all();
+	size_t count = drain(task, tasks);
+	std::unique_lock<std::mutex> guard(lock);
+	finished += count;
+	done.wait(guard, [&] { return busy == 0 && finished == tasks; });
+	job = nullptr;
+}
+
+void	Workers::setChunk(size_t members)
+{
+	chunkSize = members ? members : fanoutChunk;
+}
+
+size_t	Workers::chunk(void)
+{
+	return chunkSize;
+}
@@ -8,15 +8,42 @@
 #include "macro.h"
 #include "Message.hpp"
 #include "User.hpp"
+#include "Snapshot.hpp"
+#include "Upgrade.hpp"
+#include "Log.hpp"
+#include "Tls.hpp"
+#include "Shard.hpp"
+#include "Link.hpp"
+#include "Config.hpp"
+#include <chrono>
 #include <iostream>
 #include <stdexcept>
 #include <csignal>
+#include <thread>
 
 using namespace std;
 Server *irc;
 
 namespace {
 	volatile sig_atomic_t gSigStatus = 0;
+	volatile sig_atomic_t gUpgrade = 0;
+	volatile sig_atomic_t gReload = 0;
+
+	/* Settings applied at startup and again on every SIGHUP */
+	void apply(const Settings &settings, bool sharded) {
+		irc->configure(settings);
+		Welcome::build(irc->getName(), irc->getTime(), settings);
+		Log::setLevel(settings.logLevel);
+		Workers::setChunk(settings.chunk);
+		// Shards already use the other cpus
+		size_t threads = sharded ? 0 : std::max(1u, thread::hardware_concurrency()) - 1;
+		if (settings.fanoutThreads >= 0)
+			threads = settings.fanoutThreads;
+		if (threads != Workers::threads()) {
+			Workers::stop();
+			Workers::start(threads);
+		}
+	}
 }
 
 int main(int argc, char *argv[]) {
@@ -28,31 +55,111 @@ int main(int argc, char *argv[]) {
 
 	signal(SIGINT, [](int) { gSigStatus = 1; });
 	signal(SIGQUIT, [](int) { gSigStatus = 1; });
+	signal(SIGTERM, [](int) { gSigStatus = 1; });
 	signal(SIGPIPE, SIG_IGN);
+	signal(SIGUSR2, [](int) { gUpgrade = 1; });
+	signal(SIGHUP, [](int) { gReload = 1; });
 
+	if (not Config::load())
+		return 1;
+	const Settings &settings = Config::current();
+	const bool handoff = getenv(handoffEnv) != nullptr;
+	size_t shard = 0;
+	vector<int> shardLinks;
 	try {
-		if (argc == 3)
+		if (settings.shards > 1 && not handoff) {
+			if (argc != 3) {
+				Log::error("Shards are linked servers, they need a password");
+				return 1;
+			}
+			shard = Shard::spawn(settings.shards, settings.pin, shardLinks);
+		}
+		if (handoff) {
+			int sock = atoi(getenv(handoffEnv));
+			unsetenv(handoffEnv);
+			irc = Upgrade::resume(sock, string(argv[1]), argc == 3 ? string(argv[2]) : "");
+			Log::info("Resumed ", irc->getClients().size(), " clients and ",
+				irc->getChannels().size(), " channels");
+		}
+		else if (argc == 3)
 			irc = new Server(string(argv[1]), string(argv[2]));
 		else
 			irc = new Server(string(argv[1]));
+		if (shard)
+			irc->setName("hive-" + string(argv[1]) + "-" + to_string(shard) + ".localhost");
 	} catch (runtime_error &err) {
-		cerr << err.what() << endl;
+		Log::error("Startup failed: ", err.what());
 		return 1;
 	} catch (bad_alloc &a) {
-		cerr << "Memory allocation failed" << endl;
+		Log::error("Memory allocation failed");
 		return 1;
 	} catch (...) {
-		cerr << "Bad port number" << endl;
+		Log::error("Bad port number");
 		return 1;
 	}
 
+	Log::start(settings.logLevel, settings.logFile);
+
+	if (not settings.tlsPort.empty()) {
+		if (Tls::init(settings.tlsCert, settings.tlsKey)) {
+			try {
+				irc->listenTls(settings.tlsPort);
+				Log::info("TLS listening on port ", settings.tlsPort);
+			} catch (exception &err) {
+				Log::error("TLS: ", err.what());
+			}
+		}
+	}
+
+	for (int fd : shardLinks)
+		Link::attach(fd, "shard");
+
+	apply(settings, not shardLinks.empty());
+
+	if (not handoff && shard == 0) {
+		try {
+			auto start = chrono::steady_clock::now();
+			size_t restored = Snapshot::load(snapshotPath);
+			auto elapsed = chrono::duration<double, milli>(chrono::steady_clock::now() - start);
+			if (restored)
+				Log::info("Restored ", restored, " channels from ", snapshotPath,
+					" in ", int64_t(elapsed.count() * 1000), " us");
+		} catch (runtime_error &err) {
+			Log::error("Snapshot: ", err.what());
+		}
+	}
+	if (shard == 0)
+		irc->addTimer(snapshotInterval, [] { Snapshot::save(snapshotPath); });
+	irc->addTimer(admitPruneInterval, [] { irc->admission().prune(); });
+	irc->addTimer(topWindow, [] { irc->hitters().rotate(); });
+	irc->addTimer(sendqCheckInterval, [] { irc->expireSendq(); });
+
 	while (not gSigStatus) {
 		try {
 			irc->poll();
+			if (gReload) {
+				gReload = 0;
+				if (Config::reload())
+					apply(Config::current(), not shardLinks.empty());
+			}
+			if (gUpgrade) {
+				gUpgrade = 0;
+				if (not shardLinks.empty())
+					Log::warn("Upgrade: not supported when running shards");
+				else if (Upgrade::start(argv)) {
+					Workers::stop();
+					Log::stop();
+					return 0;
+				}
+			}
 		} catch (runtime_error &err) {
-			cerr << err.what() << endl;
+			Log::error("Event loop: ", err.what());
 		}
 	}
 
+	if (shard == 0)
+		Snapshot::write(snapshotPath);
+	Workers::stop();
 	delete irc;
+	Log::stop();
 }